@@ -0,0 +1,158 @@
+#include "arena.h"
+
+#include <stdlib.h>
+#include <stdalign.h>
+#include <stdint.h>
+#include <string.h>
+#include <pthread.h>
+
+#include "util.h"
+
+#define ARENA_MIN_BLOCK 0x1000
+#define ARENA_MAX_BLOCK 0x100000
+
+struct block {
+    struct block *next;
+    size_t size;
+    size_t used;
+    alignas(max_align_t) unsigned char data[];
+};
+
+struct arena {
+    pthread_mutex_t lock;
+    struct block *blocks;
+    size_t next_size;
+    size_t total;
+};
+
+struct arena *arena_new(void)
+{
+    struct arena *arena = calloc(1, sizeof(struct arena));
+    check_null(arena, "failed to allocate arena");
+
+    pthread_mutex_init(&arena->lock, NULL);
+    arena->next_size = ARENA_MIN_BLOCK;
+    return arena;
+}
+
+static void free_blocks(struct block *block)
+{
+    while (block) {
+        struct block *next = block->next;
+        free(block);
+        block = next;
+    }
+}
+
+void arena_free(struct arena *arena)
+{
+    if (!arena)
+        return;
+
+    free_blocks(arena->blocks);
+    pthread_mutex_destroy(&arena->lock);
+    free(arena);
+}
+
+static struct block *new_block(size_t size)
+{
+    struct block *block = malloc(sizeof(struct block) + size);
+    check_null(block, "failed to allocate arena");
+
+    block->next = NULL;
+    block->size = size;
+    block->used = 0;
+    return block;
+}
+
+static void *carve(struct arena *arena, size_t size, size_t align)
+{
+    struct block *block = arena->blocks;
+
+    if (block) {
+        size_t offset = (block->used + align - 1) & ~(align - 1);
+        if (offset + size <= block->size) {
+            block->used = offset + size;
+            return &block->data[offset];
+        }
+    }
+
+    /* Big allocations get a block to themselves, placed behind the
+     * current one so its remaining space isn't thrown away */
+    if (size > arena->next_size / 4) {
+        struct block *big = new_block(size);
+        big->used = size;
+        arena->total += size;
+        if (block) {
+            big->next = block->next;
+            block->next = big;
+        } else {
+            arena->blocks = big;
+        }
+        return big->data;
+    }
+
+    block = new_block(arena->next_size);
+    block->next = arena->blocks;
+    block->used = size;
+    arena->blocks = block;
+    arena->total += block->size;
+
+    if (arena->next_size < ARENA_MAX_BLOCK)
+        arena->next_size *= 2;
+
+    return block->data;
+}
+
+void *arena_alloc(struct arena *arena, size_t size)
+{
+    pthread_mutex_lock(&arena->lock);
+    void *ptr = carve(arena, size, alignof(max_align_t));
+    pthread_mutex_unlock(&arena->lock);
+    return ptr;
+}
+
+char *arena_strndup(struct arena *arena, const char *s, size_t len)
+{
+    len = strnlen(s, len);
+
+    pthread_mutex_lock(&arena->lock);
+    char *copy = carve(arena, len + 1, 1);
+    pthread_mutex_unlock(&arena->lock);
+
+    memcpy(copy, s, len);
+    copy[len] = '\0';
+    return copy;
+}
+
+void arena_splice(struct arena *dst, struct arena *src)
+{
+    pthread_mutex_lock(&src->lock);
+    struct block *head = src->blocks, *tail = head;
+    size_t total = src->total;
+    src->blocks = NULL;
+    src->total = 0;
+    pthread_mutex_unlock(&src->lock);
+
+    if (!head)
+        return;
+    while (tail->next)
+        tail = tail->next;
+
+    /* Slot the blocks in behind dst's current block so it carries on
+     * allocating where it left off */
+    pthread_mutex_lock(&dst->lock);
+    if (dst->blocks) {
+        tail->next = dst->blocks->next;
+        dst->blocks->next = head;
+    } else {
+        dst->blocks = head;
+    }
+    dst->total += total;
+    pthread_mutex_unlock(&dst->lock);
+}
+
+size_t arena_size(const struct arena *arena)
+{
+    return arena->total;
+}
@@ -0,0 +1,19 @@
+#pragma once
+
+#include <stddef.h>
+
+/* A bump allocator for data that all dies at the same time. Nothing
+ * allocated from an arena is freed individually; it all goes away
+ * with arena_free. Allocation is safe from multiple threads. */
+struct arena;
+
+struct arena *arena_new(void);
+void arena_free(struct arena *arena);
+
+void *arena_alloc(struct arena *arena, size_t size);
+char *arena_strndup(struct arena *arena, const char *s, size_t len);
+
+/* Move everything src owns over to dst, leaving src empty */
+void arena_splice(struct arena *dst, struct arena *src);
+
+size_t arena_size(const struct arena *arena);
@@ -4,6 +4,7 @@
 #include <stdlib.h>
 #include <stdarg.h>
 #include <stdint.h>
+#include <string.h>
 #include <errno.h>
 #include "util.h"
 
@@ -67,6 +68,17 @@ void buffer_clear(struct buffer *buf)
         buf->data[buf->len] = '\0';
 }
 
+int buffer_append(struct buffer *buf, const char *data, size_t len)
+{
+    if (buffer_extendby(buf, len + 1) < 0)
+        return -errno;
+
+    memcpy(&buf->data[buf->len], data, len);
+    buf->len += len;
+    buf->data[buf->len] = '\0';
+    return 0;
+}
+
 int buffer_putc(struct buffer *buf, const char c)
 {
     if (buffer_extendby(buf, 2) < 0)
@@ -101,3 +113,56 @@ ssize_t buffer_printf(struct buffer *buf, const char *fmt, ...)
     buf->len += nbytes_w;
     return nbytes_w;
 }
+
+int buffer_puts(struct buffer *buf, const char *str)
+{
+    return buffer_append(buf, str, strlen(str));
+}
+
+int buffer_put_uint(struct buffer *buf, uintmax_t value)
+{
+    char digits[3 * sizeof(uintmax_t)];
+    char *p = digits + sizeof(digits);
+
+    do {
+        *--p = '0' + value % 10;
+        value /= 10;
+    } while (value);
+
+    return buffer_append(buf, p, digits + sizeof(digits) - p);
+}
+
+int buffer_put_int(struct buffer *buf, intmax_t value)
+{
+    if (value < 0) {
+        if (buffer_putc(buf, '-') < 0)
+            return -errno;
+        return buffer_put_uint(buf, -(uintmax_t)value);
+    }
+
+    return buffer_put_uint(buf, value);
+}
+
+/* Append every string in the list, each one followed by sep. The whole
+ * run is measured first so the buffer grows at most once. */
+int buffer_put_list(struct buffer *buf, const alpm_list_t *list, char sep)
+{
+    size_t total = 1;
+    for (const alpm_list_t *node = list; node; node = node->next) {
+        if (addsz(total, strlen(node->data) + 1, &total) < 0)
+            return -errno;
+    }
+
+    if (buffer_extendby(buf, total) < 0)
+        return -errno;
+
+    for (; list; list = list->next) {
+        const size_t len = strlen(list->data);
+        memcpy(&buf->data[buf->len], list->data, len);
+        buf->len += len;
+        buf->data[buf->len++] = sep;
+    }
+
+    buf->data[buf->len] = '\0';
+    return 0;
+}
@@ -1,7 +1,9 @@
 #pragma once
 
 #include <stdlib.h>
+#include <stdint.h>
 #include <sys/types.h>
+#include <alpm_list.h>
 
 struct buffer {
     char *data;
@@ -13,5 +15,13 @@ int buffer_reserve(struct buffer *buf, size_t reserve);
 void buffer_release(struct buffer *buf);
 void buffer_clear(struct buffer *buf);
 
+int buffer_append(struct buffer *buf, const char *data, size_t len);
 int buffer_putc(struct buffer *buf, const char c);
 ssize_t buffer_printf(struct buffer *buf, const char *fmt, ...) __attribute__((format (printf, 2, 3)));
+
+/* Typed appends for the hot paths that would otherwise go through
+ * buffer_printf, skipping format string parsing entirely. */
+int buffer_puts(struct buffer *buf, const char *str);
+int buffer_put_uint(struct buffer *buf, uintmax_t value);
+int buffer_put_int(struct buffer *buf, intmax_t value);
+int buffer_put_list(struct buffer *buf, const alpm_list_t *list, char sep);
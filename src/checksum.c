@@ -0,0 +1,93 @@
+#include "checksum.h"
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <err.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <openssl/evp.h>
+
+#include "mapping.h"
+#include "ingest.h"
+#include "util.h"
+
+/* Going through the EVP interface rather than the legacy SHA256_*
+ * calls lets OpenSSL dispatch to the SHA extensions or AVX2 code paths
+ * when the CPU supports them. */
+struct checksum {
+    EVP_MD_CTX *ctx;
+};
+
+struct checksum *checksum_new(void)
+{
+    struct checksum *checksum = malloc(sizeof(struct checksum));
+    check_null(checksum, "failed to allocate checksum");
+
+    checksum->ctx = EVP_MD_CTX_new();
+    check_null(checksum->ctx, "failed to allocate digest context");
+
+    if (!EVP_DigestInit_ex(checksum->ctx, EVP_sha256(), NULL))
+        errx(EXIT_FAILURE, "failed to initialize sha256 digest");
+
+    return checksum;
+}
+
+void checksum_update(struct checksum *checksum, const void *data, size_t len)
+{
+    EVP_DigestUpdate(checksum->ctx, data, len);
+}
+
+char *checksum_final(struct checksum *checksum)
+{
+    unsigned char output[EVP_MAX_MD_SIZE];
+    unsigned int len;
+
+    EVP_DigestFinal_ex(checksum->ctx, output, &len);
+    EVP_MD_CTX_free(checksum->ctx);
+    free(checksum);
+
+    return hex_representation(output, len);
+}
+
+static char *sha256_stream(int fd)
+{
+    struct checksum *checksum = checksum_new();
+
+    for (;;) {
+        char buf[0x10000];
+        ssize_t nbytes_r = read(fd, buf, sizeof(buf));
+        check_posix(nbytes_r, "failed to read file");
+        if (nbytes_r == 0)
+            break;
+        checksum_update(checksum, buf, nbytes_r);
+    }
+
+    return checksum_final(checksum);
+}
+
+char *sha256_fd(int fd)
+{
+    struct ingest ingest;
+    ingest_begin(&ingest, fd, true);
+
+    char *sha256sum;
+    struct mapping map;
+    if (mapping_open(&map, fd) < 0) {
+        sha256sum = sha256_stream(fd);
+    } else {
+        struct checksum *checksum = checksum_new();
+        checksum_update(checksum, map.data, map.len);
+        mapping_close(&map);
+        sha256sum = checksum_final(checksum);
+    }
+
+    ingest_end(&ingest);
+    return sha256sum;
+}
+
+char *sha256_file(int dirfd, const char *filename)
+{
+    _cleanup_close_ int fd = ingest_open(dirfd, filename);
+    check_posix(fd, "failed to open %s for sha256 checksum", filename);
+    return sha256_fd(fd);
+}
@@ -0,0 +1,12 @@
+#pragma once
+
+#include <stddef.h>
+
+struct checksum;
+
+struct checksum *checksum_new(void);
+void checksum_update(struct checksum *checksum, const void *data, size_t len);
+char *checksum_final(struct checksum *checksum);
+
+char *sha256_fd(int fd);
+char *sha256_file(int dirfd, const char *filename);
@@ -12,21 +12,29 @@
 #include <fcntl.h>
 #include <err.h>
 #include <time.h>
+#include <pthread.h>
 #include <sys/stat.h>
-#include <openssl/sha.h>
 
 #include "repose.h"
 #include "package.h"
-#include "pkghash.h"
+#include "pkgcache.h"
+#include "filelist.h"
+#include "mapping.h"
+#include "ingest.h"
+#include "segments.h"
 #include "util.h"
 #include "desc.h"
 #include "buffer.h"
 #include "signing.h"
+#include "checksum.h"
+#include "worker.h"
 
 struct db {
     int fd;
     struct archive *archive;
     time_t mtime;
+    struct mapping map;
+    struct arena *arena;
     struct pkg *likely_pkg;
 };
 
@@ -37,32 +45,6 @@ struct dbentry {
     const char *version;
 };
 
-static char *sha256_fd(int fd)
-{
-    SHA256_CTX ctx;
-    unsigned char output[32];
-
-    SHA256_Init(&ctx);
-    for (;;) {
-        char buf[BUFSIZ];
-        ssize_t nbytes_r = read(fd, buf, sizeof(buf));
-        check_posix(nbytes_r, "failed to read file");
-        if (nbytes_r == 0)
-            break;
-        SHA256_Update(&ctx, buf, nbytes_r);
-    }
-    SHA256_Final(output, &ctx);
-
-    return hex_representation(output, sizeof(output));
-}
-
-static char *sha256_file(int dirfd, const char *filename)
-{
-    _cleanup_close_ int fd = openat(dirfd, filename, O_RDONLY);
-    check_posix(fd, "failed to open %s for sha256 checksum", filename);
-    return sha256_fd(fd);
-}
-
 static int open_database(struct db *db, int fd)
 {
     struct stat st;
@@ -77,14 +59,30 @@ static int open_database(struct db *db, int fd)
     archive_read_support_filter_all(db->archive);
     archive_read_support_format_all(db->archive);
 
-    if (archive_read_open_fd(db->archive, fd, 8192) != ARCHIVE_OK) {
-        archive_read_close(db->archive);
+    /* Hand libarchive the whole file at once when we can, otherwise
+     * read it in large blocks */
+    int status;
+    if (mapping_open(&db->map, fd) == 0)
+        status = archive_read_open_memory(db->archive, db->map.data, db->map.len);
+    else
+        status = archive_read_open_fd(db->archive, fd, READ_BLOCK_SIZE);
+
+    if (status != ARCHIVE_OK) {
         archive_read_free(db->archive);
+        mapping_close(&db->map);
+        return -1;
     }
 
     return 0;
 }
 
+static void close_database(struct db *db)
+{
+    archive_read_close(db->archive);
+    archive_read_free(db->archive);
+    mapping_close(&db->map);
+}
+
 static int parse_database_pathname(const char *entryname, struct dbentry *entry)
 {
     entry->name = strdup(entryname);
@@ -109,30 +107,21 @@ static inline void dbentry_free(struct dbentry *dbentry)
 }
 
 static struct pkg *get_package(struct db *db, struct dbentry *dbentry,
-                               alpm_pkghash_t **pkgcache, bool allocate)
+                               struct pkgcache *pkgcache, bool allocate)
 {
     struct pkg *pkg;
 
-    if (db->likely_pkg) {
-        unsigned long pkgname_hash = _alpm_hash_sdbm(dbentry->name);
-        if (pkgname_hash == db->likely_pkg->name_hash && streq(db->likely_pkg->name, dbentry->name))
-            return db->likely_pkg;
-    }
+    if (db->likely_pkg && streq(db->likely_pkg->name, dbentry->name))
+        return db->likely_pkg;
 
-    pkg = _alpm_pkghash_find(*pkgcache, dbentry->name);
+    pkg = pkgcache_find(pkgcache, dbentry->name);
     if (allocate && !pkg) {
-        pkg = malloc(sizeof(struct pkg));
-        if (!pkg)
-            return NULL;
-
-        *pkg = (struct pkg){
-            .name = strdup(dbentry->name),
-            .name_hash = _alpm_hash_sdbm(dbentry->name),
-            .version = strdup(dbentry->version),
-            .mtime = db->mtime
-        };
+        pkg = package_new(db->arena);
+        package_set(pkg, PKG_PKGNAME, dbentry->name, strlen(dbentry->name));
+        package_set(pkg, PKG_VERSION, dbentry->version, strlen(dbentry->version));
+        pkg->mtime = db->mtime;
 
-        *pkgcache = _alpm_pkghash_add_sorted(*pkgcache, pkg);
+        pkgcache_add(pkgcache, pkg);
     }
 
     if (pkg)
@@ -158,8 +147,37 @@ static bool is_database_metadata(const char *entry_name)
     return false;
 }
 
+static int64_t *entry_offset(struct pkg *pkg, enum contents member)
+{
+    switch (member) {
+    case DB_DESC:
+        return &pkg->desc_offset;
+    case DB_DEPENDS:
+        return &pkg->depends_offset;
+    default:
+        return &pkg->files_offset;
+    }
+}
+
+static void note_entry(struct db *db, struct archive_entry *entry,
+                       struct pkg *pkg, enum contents member)
+{
+    const char *uname = archive_entry_uname(entry);
+
+    /* Only what we wrote ourselves is known to come out the same if
+     * rendered again. An entry that's shown up before, in another
+     * database, has been merged with that one and must be rendered. */
+    if (!(pkg->seen & member) && uname && streq(uname, "repose"))
+        pkg->verbatim |= member;
+    else
+        pkg->verbatim &= ~member;
+
+    pkg->seen |= member;
+    *entry_offset(pkg, member) = archive_read_header_position(db->archive);
+}
+
 static int parse_database_entry(struct db *db, struct archive_entry *entry,
-                                alpm_pkghash_t **pkgcache)
+                                struct pkgcache *pkgcache)
 {
     const char *pathname = archive_entry_pathname(entry);
     struct dbentry dbentry;
@@ -179,7 +197,15 @@ static int parse_database_entry(struct db *db, struct archive_entry *entry,
             goto cleanup;
         }
 
-        if (pkg) {
+        if (pkg && streq(dbentry.type, "files")) {
+            /* File lists are only needed for packages whose entries get
+             * rewritten; note where this one is and move on */
+            if (!pkg->files) {
+                note_entry(db, entry, pkg, DB_FILES);
+                pkg->files_pending = true;
+            }
+        } else if (pkg) {
+            note_entry(db, entry, pkg, streq(dbentry.type, "desc") ? DB_DESC : DB_DEPENDS);
             read_desc(db->archive, pkg);
         }
     }
@@ -189,35 +215,56 @@ cleanup:
     return ret;
 }
 
-int load_database(int fd, alpm_pkghash_t **pkgcache)
+int load_database(int fd, struct pkgcache *pkgcache, struct arena *arena)
 {
     struct db db;
     struct archive_entry *entry;
 
     if (open_database(&db, fd) < 0)
         return -1;
+    db.arena = arena;
 
     while (archive_read_next_header(db.archive, &entry) == ARCHIVE_OK) {
         const mode_t mode = archive_entry_mode(entry);
 
         if (S_ISREG(mode) && parse_database_entry(&db, entry, pkgcache) < 0) {
-            archive_read_close(db.archive);
-            archive_read_free(db.archive);
+            close_database(&db);
             return -1;
         }
     }
 
+    close_database(&db);
+
+    /* Entries are appended as they're found; put them in order once
+     * everything is loaded */
+    pkgcache_sort(pkgcache);
     return 0;
 }
 
+static void write_header(struct buffer *buf, const char *header)
+{
+    buffer_putc(buf, '%');
+    buffer_puts(buf, header);
+    buffer_append(buf, "%\n", 2);
+}
+
 static void write_list(struct buffer *buf, const char *header, const alpm_list_t *lst)
 {
     if (lst == NULL)
         return;
 
-    buffer_printf(buf, "%%%s%%\n", header);
-    for (; lst; lst = lst->next)
-        buffer_printf(buf, "%s\n", (const char *)lst->data);
+    write_header(buf, header);
+    buffer_put_list(buf, lst, '\n');
+    buffer_putc(buf, '\n');
+}
+
+static void write_filelist(struct buffer *buf, const char *header, const struct filelist *files)
+{
+    if (files == NULL)
+        return;
+
+    write_header(buf, header);
+    filelist_write(files, buf);
     buffer_putc(buf, '\n');
 }
 
@@ -226,21 +273,23 @@ static void write_string(struct buffer *buf, const char *header, const char *str
     if (str == NULL)
         return;
 
-    buffer_printf(buf, "%%%s%%\n%s\n\n", header, str);
+    write_header(buf, header);
+    buffer_puts(buf, str);
+    buffer_append(buf, "\n\n", 2);
 }
 
 static void write_size(struct buffer *buf, const char *header, size_t val)
 {
-    buffer_printf(buf, "%%%s%%\n%zd\n\n", header, val);
+    write_header(buf, header);
+    buffer_put_uint(buf, val);
+    buffer_append(buf, "\n\n", 2);
 }
 
 static void write_time(struct buffer *buf, const char *header, time_t val)
 {
-#ifdef __QNX__
-    buffer_printf(buf, "%%%s%%\n%d\n\n", header, val);
-#else
-    buffer_printf(buf, "%%%s%%\n%ld\n\n", header, val);
-#endif
+    write_header(buf, header);
+    buffer_put_int(buf, val);
+    buffer_append(buf, "\n\n", 2);
 }
 
 static void compile_depends_entry(struct pkg *pkg, struct buffer *buf)
@@ -253,7 +302,7 @@ static void compile_depends_entry(struct pkg *pkg, struct buffer *buf)
     write_list(buf, "CHECKDEPENDS", pkg->checkdepends);
 }
 
-static void compile_desc_entry(struct pkg *pkg, struct buffer *buf, int poolfd)
+static void write_desc_entry(struct pkg *pkg, struct buffer *buf)
 {
     write_string(buf, "FILENAME",  pkg->filename);
     write_string(buf, "NAME",      pkg->name);
@@ -267,8 +316,6 @@ static void compile_desc_entry(struct pkg *pkg, struct buffer *buf, int poolfd)
     if (pkg->base64sig) {
         write_string(buf, "PGPSIG", pkg->base64sig);
     } else {
-        if (!pkg->sha256sum)
-            pkg->sha256sum = sha256_file(poolfd, pkg->filename);
         write_string(buf, "SHA256SUM", pkg->sha256sum);
     }
 
@@ -280,17 +327,220 @@ static void compile_desc_entry(struct pkg *pkg, struct buffer *buf, int poolfd)
     write_list(buf, "REPLACES",  pkg->replaces);
 }
 
-static void compile_files_entry(struct pkg *pkg, struct buffer *buf, int poolfd)
+static void load_package_contents(struct pkg *pkg, int poolfd, int flags)
+{
+    _cleanup_close_ int pkgfd = ingest_open(poolfd, pkg->filename);
+    check_posix(pkgfd, "failed to open %s", pkg->filename);
+
+    load_package(pkg, pkgfd, flags);
+}
+
+static inline bool needs_checksum(const struct pkg *pkg)
+{
+    return !pkg->base64sig && !pkg->sha256sum;
+}
+
+static void compute_checksum(struct pkg *pkg, const struct repo *repo)
 {
-    if (!pkg->files) {
-        _cleanup_close_ int pkgfd = openat(poolfd, pkg->filename, O_RDONLY);
-        if (pkgfd < 0 && errno != ENOENT)
-            err(EXIT_FAILURE, "failed to open %s", pkg->filename);
+    /* A desc gaining a checksum can't be copied over verbatim */
+    pkg->verbatim &= ~DB_DESC;
 
-        load_package_files(pkg, pkgfd);
+    /* If we're going to need the file list later anyway, get it out
+     * of the same read that computes the checksum. */
+    if (repo->filesname && !pkg->files && !pkg->files_pending) {
+        load_package_contents(pkg, repo->poolfd, PKG_LOAD_SHA256 | PKG_LOAD_FILES);
+    } else {
+        _cleanup_free_ char *sha256sum = sha256_file(repo->poolfd, pkg->filename);
+        if (sha256sum)
+            package_set(pkg, PKG_SHA256SUM, sha256sum, strlen(sha256sum));
     }
+}
+
+struct checksum_job {
+    const struct repo *repo;
+    struct pkg **pkgs;
+};
 
-    write_list(buf, "FILES", pkg->files);
+static void checksum_one(size_t idx, void *arg)
+{
+    struct checksum_job *job = arg;
+    compute_checksum(job->pkgs[idx], job->repo);
+}
+
+/* Unsigned packages are recorded by their checksum. Rather than
+ * computing them one at a time while the database is being written,
+ * compute all the missing ones up front, in parallel. */
+static void compute_checksums(const struct repo *repo)
+{
+    size_t count = 0, total = 0;
+    struct pkg *pkg;
+
+    pkgcache_foreach(repo->cache, pkg) {
+        if (needs_checksum(pkg))
+            ++count;
+    }
+
+    if (count == 0)
+        return;
+
+    _cleanup_free_ struct pkg **pkgs = malloc(count * sizeof(struct pkg *));
+    check_null(pkgs, "failed to allocate checksum queue");
+
+    count = 0;
+    pkgcache_foreach(repo->cache, pkg) {
+        if (needs_checksum(pkg)) {
+            pkgs[count++] = pkg;
+            total += pkg->size;
+        }
+    }
+
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    struct checksum_job job = { .repo = repo, .pkgs = pkgs };
+    parallel_for(count, config.jobs, checksum_one, &job);
+
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    double elapsed = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+    trace("checksummed %zu packages (%.1f MiB) in %.2fs, %.1f MiB/s\n",
+          count, total / 1048576.0, elapsed,
+          elapsed > 0 ? total / 1048576.0 / elapsed : 0.0);
+}
+
+static void compile_desc_entry(struct pkg *pkg, struct buffer *buf,
+                               const struct repo *repo)
+{
+    if (needs_checksum(pkg))
+        compute_checksum(pkg, repo);
+
+    write_desc_entry(pkg, buf);
+}
+
+/* Serialize everything we know about a package, without computing any
+ * missing checksums, in the same format as the desc and depends
+ * database entries. */
+void compile_package_metadata(struct pkg *pkg, struct buffer *buf)
+{
+    write_desc_entry(pkg, buf);
+    compile_depends_entry(pkg, buf);
+}
+
+/* The database being replaced, read forward alongside the one being
+ * written to copy out unchanged entries and to pick up file lists that
+ * were never loaded */
+struct db_source {
+    int fd;
+    bool open;
+    bool unsorted;
+    int64_t last;
+    struct pkgcache *pkgcache;
+    struct db db;
+};
+
+static void db_source_close(struct db_source *src)
+{
+    if (src->open)
+        close_database(&src->db);
+    src->open = false;
+}
+
+static int db_source_rewind(struct db_source *src)
+{
+    db_source_close(src);
+
+    if (src->fd < 0 || lseek(src->fd, 0, SEEK_SET) < 0)
+        return -1;
+    if (open_database(&src->db, src->fd) < 0)
+        return -1;
+
+    src->open = true;
+    src->last = -1;
+    return 0;
+}
+
+/* Read every file list that's still wanted out of the source in a
+ * single pass */
+static void db_source_load(struct db_source *src)
+{
+    if (db_source_rewind(src) < 0)
+        return;
+
+    struct archive_entry *entry;
+    while (archive_read_next_header(src->db.archive, &entry) == ARCHIVE_OK) {
+        struct dbentry dbentry;
+
+        if (!S_ISREG(archive_entry_mode(entry)))
+            continue;
+
+        if (parse_database_pathname(archive_entry_pathname(entry), &dbentry) == 0 &&
+            streq(dbentry.type, "files")) {
+            struct pkg *pkg = pkgcache_find(src->pkgcache, dbentry.name);
+            if (pkg && pkg->files_pending && !pkg->files)
+                read_desc(src->db.archive, pkg);
+        }
+
+        dbentry_free(&dbentry);
+    }
+
+    db_source_close(src);
+}
+
+static int db_source_seek(struct db_source *src, int64_t offset)
+{
+    if (src->unsorted)
+        return -1;
+
+    /* Both databases are written in the same order, so this normally
+     * only ever moves forward. One that wasn't, by an older repose or
+     * by repo-add, would be read again from the start for every entry
+     * out of place. Load what's still wanted out of it in one go
+     * instead, and render everything else. */
+    if (src->open && offset <= src->last) {
+        src->unsorted = true;
+        db_source_load(src);
+        return -1;
+    }
+
+    if (!src->open && db_source_rewind(src) < 0)
+        return -1;
+
+    struct archive_entry *entry;
+    while (archive_read_next_header(src->db.archive, &entry) == ARCHIVE_OK) {
+        src->last = archive_read_header_position(src->db.archive);
+        if (src->last == offset)
+            return 0;
+        if (src->last > offset)
+            break;
+    }
+
+    db_source_close(src);
+    return -1;
+}
+
+/* Copy an entry we wrote last time straight out of the old database.
+ * Returns false if it has to be rendered instead. */
+static bool copy_entry(struct db_source *src, struct pkg *pkg,
+                       enum contents member, struct buffer *buf)
+{
+    if (!(pkg->verbatim & member))
+        return false;
+    if (db_source_seek(src, *entry_offset(pkg, member)) < 0)
+        return false;
+
+    for (;;) {
+        const void *block;
+        size_t size;
+        int64_t offset;
+
+        int status = archive_read_data_block(src->db.archive, &block, &size, &offset);
+        if (status == ARCHIVE_EOF)
+            return true;
+        if (status != ARCHIVE_OK || buffer_append(buf, block, size) < 0)
+            break;
+    }
+
+    buffer_clear(buf);
+    return false;
 }
 
 static void archive_entry_populate(struct archive_entry *e, unsigned int type,
@@ -321,83 +571,722 @@ static void record_entry(struct archive *archive, struct archive_entry *e,
     buffer_clear(buf);
 }
 
-static void compile_database_entry(struct archive *archive, struct archive_entry *e, struct pkg *pkg,
-                                   int contents, struct buffer *buf, int poolfd)
+/* Packages are compressed a batch at a time, spread across threads in
+ * chunks of at most SEGMENT_CHUNK_SIZE bytes, each a member of its own.
+ * A batch is started on once it holds SEGMENT_BATCH_SIZE bytes. */
+#define SEGMENT_CHUNK_SIZE 0x100000
+#define SEGMENT_BATCH_SIZE 0x2000000
+
+struct pending {
+    char *key;
+    struct buffer raw;
+    struct buffer out;
+    bool reused;
+    size_t first_chunk;
+    size_t chunks;
+};
+
+struct chunk {
+    const char *data;
+    size_t len;
+    struct buffer out;
+    int status;
+};
+
+/* Collects the uncompressed tar stream of a database as it's written,
+ * so that each package can be compressed as a segment of its own. The
+ * archive's header and trailer go in segments without a key, which
+ * aren't indexed. */
+struct segwriter {
+    int fd;
+    off_t offset;
+    struct buffer raw;
+    struct segindex *next;
+
+    struct pending *pending;
+    size_t count;
+    size_t size;
+    size_t bytes;
+
+    size_t reused;
+    size_t compressed;
+};
+
+static ssize_t segwriter_write(struct archive *archive, void *data,
+                               const void *buf, size_t len)
 {
-    _cleanup_free_ char *entrypath = joinstring(pkg->name, "-", pkg->version, NULL);
+    struct segwriter *writer = data;
 
-    archive_entry_populate(e, AE_IFDIR, entrypath, 0755);
-    archive_write_header(archive, e);
-    archive_entry_clear(e);
+    if (buffer_append(&writer->raw, buf, len) < 0) {
+        archive_set_error(archive, errno, "failed to buffer database segment");
+        return -1;
+    }
+    return len;
+}
+
+static struct pending *segwriter_push(struct segwriter *writer, const char *key)
+{
+    if (writer->count == writer->size) {
+        writer->size = writer->size ? writer->size * 2 : 64;
+        writer->pending = realloc(writer->pending, writer->size * sizeof(struct pending));
+        check_null(writer->pending, "failed to allocate segment queue");
+    }
+
+    struct pending *pending = &writer->pending[writer->count++];
+    *pending = (struct pending){ .key = key ? strdup(key) : NULL };
+    return pending;
+}
+
+static int write_all(int fd, const struct buffer *buf)
+{
+    for (size_t written = 0; written < buf->len;) {
+        ssize_t nbytes = write(fd, &buf->data[written], buf->len - written);
+        if (nbytes < 0)
+            return -1;
+        written += nbytes;
+    }
+    return 0;
+}
+
+static void compress_chunk(size_t idx, void *arg)
+{
+    struct chunk *chunk = &((struct chunk *)arg)[idx];
+    chunk->status = segment_compress(config.compression, config.compression_level,
+                                     chunk->data, chunk->len, &chunk->out);
+}
+
+/* Compress everything queued up and write it out in order */
+static int segwriter_flush(struct segwriter *writer)
+{
+    size_t count = 0;
+    for (size_t i = 0; i < writer->count; ++i) {
+        struct pending *pending = &writer->pending[i];
+        if (!pending->reused) {
+            pending->first_chunk = count;
+            pending->chunks = pending->raw.len ? (pending->raw.len + SEGMENT_CHUNK_SIZE - 1) / SEGMENT_CHUNK_SIZE : 1;
+            count += pending->chunks;
+        }
+    }
+
+    _cleanup_free_ struct chunk *chunks = calloc(count, sizeof(struct chunk));
+    check_null(chunks, "failed to allocate compression queue");
+
+    for (size_t i = 0; i < writer->count; ++i) {
+        const struct pending *pending = &writer->pending[i];
+        if (pending->reused)
+            continue;
+
+        for (size_t c = 0; c < pending->chunks; ++c) {
+            const size_t start = c * SEGMENT_CHUNK_SIZE;
+            chunks[pending->first_chunk + c] = (struct chunk){
+                .data = &pending->raw.data[start],
+                .len = pending->raw.len - start < SEGMENT_CHUNK_SIZE ? pending->raw.len - start : SEGMENT_CHUNK_SIZE
+            };
+        }
+    }
+
+    if (count)
+        parallel_for(count, config.threads, compress_chunk, chunks);
+
+    int ret = 0;
+    for (size_t i = 0; i < writer->count; ++i) {
+        struct pending *pending = &writer->pending[i];
+        const off_t offset = writer->offset;
+
+        if (pending->reused) {
+            if (ret == 0 && write_all(writer->fd, &pending->out) < 0)
+                ret = -1;
+            writer->offset += pending->out.len;
+        } else {
+            for (size_t c = 0; c < pending->chunks; ++c) {
+                const struct chunk *chunk = &chunks[pending->first_chunk + c];
+                if (ret == 0 && (chunk->status < 0 || write_all(writer->fd, &chunk->out) < 0))
+                    ret = -1;
+                writer->offset += chunk->out.len;
+            }
+        }
+
+        if (ret == 0 && pending->key)
+            segindex_add(writer->next, pending->key, offset, writer->offset - offset);
+
+        free(pending->key);
+        buffer_release(&pending->raw);
+        buffer_release(&pending->out);
+    }
+
+    for (size_t i = 0; i < count; ++i)
+        buffer_release(&chunks[i].out);
+
+    writer->count = 0;
+    writer->bytes = 0;
+    return ret;
+}
+
+/* Queue up everything the archive has written since the last call as
+ * a segment to compress */
+static int segwriter_cut(struct segwriter *writer, const char *key)
+{
+    struct pending *pending = segwriter_push(writer, key);
+    pending->raw = writer->raw;
+    writer->raw = (struct buffer){0};
+
+    writer->bytes += pending->raw.len;
+    if (key)
+        ++writer->compressed;
+
+    if (writer->bytes >= SEGMENT_BATCH_SIZE)
+        return segwriter_flush(writer);
+    return 0;
+}
+
+/* Read a segment compressed last time out of the old database */
+static int load_segment(int fd, const struct segment *segment, struct buffer *buf)
+{
+    if (fd < 0 || buffer_reserve(buf, segment->len) < 0)
+        return -1;
+
+    for (size_t nread = 0; nread < segment->len;) {
+        ssize_t nbytes = pread(fd, &buf->data[nread], segment->len - nread,
+                               segment->offset + nread);
+        if (nbytes <= 0) {
+            buffer_clear(buf);
+            return -1;
+        }
+        nread += nbytes;
+    }
+
+    buf->len = segment->len;
+    return 0;
+}
+
+/* Queue up an already compressed segment, taking over its buffer */
+static int segwriter_reuse(struct segwriter *writer, const char *key, struct buffer *buf)
+{
+    struct pending *pending = segwriter_push(writer, key);
+    pending->out = *buf;
+    pending->reused = true;
+    *buf = (struct buffer){0};
+
+    writer->bytes += pending->out.len;
+    ++writer->reused;
+
+    if (writer->bytes >= SEGMENT_BATCH_SIZE)
+        return segwriter_flush(writer);
+    return 0;
+}
+
+static void segwriter_release(struct segwriter *writer)
+{
+    for (size_t i = 0; i < writer->count; ++i) {
+        free(writer->pending[i].key);
+        buffer_release(&writer->pending[i].raw);
+        buffer_release(&writer->pending[i].out);
+    }
+    free(writer->pending);
+    buffer_release(&writer->raw);
+}
+
+/* Everything that ends up in a package's segment follows from the
+ * package file it was read from, its name, and what's being written */
+static char *segment_key(const struct pkg *pkg, enum contents what)
+{
+    const char *fields[] = {
+        pkg->name,
+        pkg->version,
+        pkg->filename,
+        pkg->base64sig ? pkg->base64sig : pkg->sha256sum
+    };
+
+    struct checksum *checksum = checksum_new();
+    char header[48];
+    int len = snprintf(header, sizeof(header), "%d %d %d", what, config.compression,
+                       config.compression_level);
+    checksum_update(checksum, header, len + 1);
+
+    for (size_t i = 0; i < sizeof(fields) / sizeof(fields[0]); ++i) {
+        const char *field = fields[i] ? fields[i] : "";
+        checksum_update(checksum, field, strlen(field) + 1);
+    }
+
+    return checksum_final(checksum);
+}
+
+/* Packages are rendered a batch at a time on worker threads, while the
+ * batch before is written out */
+#define RENDER_BATCH 256
+
+/* Databases written in the same pass: the .db, and the .files */
+#define MAX_OUTPUTS 2
 
-    if (contents & DB_DESC) {
-        compile_desc_entry(pkg, buf, poolfd);
-        record_entry(archive, e, entrypath, "desc", buf);
+enum {
+    ENTRY_DESC,
+    ENTRY_DEPENDS,
+    ENTRY_FILES,
+    ENTRY_MAX
+};
+
+static const struct {
+    enum contents member;
+    const char *name;
+} entry_types[ENTRY_MAX] = {
+    [ENTRY_DESC]    = { DB_DESC,    "desc" },
+    [ENTRY_DEPENDS] = { DB_DEPENDS, "depends" },
+    [ENTRY_FILES]   = { DB_FILES,   "files" }
+};
+
+/* A database being written, along with the one it replaces */
+struct output {
+    const char *name;
+    int contents;
+    char *tmpname;
+    char *indexname;
+    int fd;
+    int oldfd;
+    bool segmented;
+    struct db_source src;
+    struct segindex *index;
+    struct segwriter writer;
+    struct archive *archive;
+    struct archive_entry *entry;
+    pthread_t thread;
+    int status;
+};
+
+/* A package's database entries, ready to be written. For each output,
+ * either it's a whole compressed segment from the old database, or the
+ * entries that output wants are rendered. Each entry only belongs to
+ * one output. */
+struct rendered {
+    struct pkg *pkg;
+    bool borrowed;
+    bool wanted[ENTRY_MAX];
+    bool ready[ENTRY_MAX];
+    struct buffer entries[ENTRY_MAX];
+
+    struct {
+        char *key;
+        bool cached;
+        struct buffer segment;
+    } outputs[MAX_OUTPUTS];
+};
+
+struct render_batch {
+    const struct repo *repo;
+    pthread_t thread;
+    size_t count;
+    struct rendered items[RENDER_BATCH];
+};
+
+static struct output *entry_output(struct output *outputs, size_t count, int type)
+{
+    for (size_t o = 0; o < count; ++o) {
+        if (outputs[o].contents & entry_types[type].member)
+            return &outputs[o];
     }
-    if (contents & DB_DEPENDS) {
-        compile_depends_entry(pkg, buf);
-        record_entry(archive, e, entrypath, "depends", buf);
+    return NULL;
+}
+
+/* Anything which needs the old databases, which can only be read in
+ * order, is dealt with up front before the batch goes to the workers */
+static size_t render_prepare(struct render_batch *batch, struct pkg **pkgs, size_t count,
+                             size_t start, struct output *outputs, size_t noutputs)
+{
+    batch->count = count - start < RENDER_BATCH ? count - start : RENDER_BATCH;
+    for (size_t i = 0; i < batch->count; ++i) {
+        struct rendered *item = &batch->items[i];
+        struct pkg *pkg = pkgs[start + i];
+        *item = (struct rendered){ .pkg = pkg };
+
+        for (size_t o = 0; o < noutputs; ++o) {
+            struct output *out = &outputs[o];
+            if (!out->index)
+                continue;
+
+            item->outputs[o].key = segment_key(pkg, out->contents);
+
+            const struct segment *segment = segindex_find(out->index, item->outputs[o].key);
+            if (segment && load_segment(out->oldfd, segment, &item->outputs[o].segment) == 0)
+                item->outputs[o].cached = true;
+        }
+
+        for (int e = 0; e < ENTRY_MAX; ++e) {
+            struct output *out = entry_output(outputs, noutputs, e);
+            if (!out || item->outputs[out - outputs].cached)
+                continue;
+
+            item->wanted[e] = true;
+            item->ready[e] = copy_entry(&out->src, pkg, entry_types[e].member, &item->entries[e]);
+        }
+
+        if (item->wanted[ENTRY_FILES] && !item->ready[ENTRY_FILES] && pkg->files_pending) {
+            struct db_source *src = &entry_output(outputs, noutputs, ENTRY_FILES)->src;
+            if (!pkg->files && db_source_seek(src, pkg->files_offset) == 0)
+                read_desc(src->db.archive, pkg);
+
+            /* Read back just now, or when an out of order database was
+             * loaded whole */
+            item->borrowed = pkg->files != NULL;
+        }
+
+        /* Past here, nothing should read this file list back in */
+        pkg->files_pending = false;
     }
-    if (contents & DB_FILES) {
-        compile_files_entry(pkg, buf, poolfd);
-        record_entry(archive, e, entrypath, "files", buf);
+
+    return start + batch->count;
+}
+
+static void render_one(size_t idx, void *arg)
+{
+    struct render_batch *batch = arg;
+    struct rendered *item = &batch->items[idx];
+    struct pkg *pkg = item->pkg;
+
+    for (int e = 0; e < ENTRY_MAX; ++e) {
+        if (!item->wanted[e] || item->ready[e])
+            continue;
+
+        struct buffer *buf = &item->entries[e];
+        switch (e) {
+        case ENTRY_DESC:
+            compile_desc_entry(pkg, buf, batch->repo);
+            break;
+        case ENTRY_DEPENDS:
+            compile_depends_entry(pkg, buf);
+            break;
+        case ENTRY_FILES:
+            if (!pkg->files)
+                load_package_contents(pkg, batch->repo->poolfd, PKG_LOAD_FILES);
+            write_filelist(buf, "FILES", pkg->files);
+            break;
+        }
+        item->ready[e] = true;
     }
 }
 
-static int compile_database(struct repo *repo, const char *repo_name,
-                            enum contents what)
+static void *render_main(void *arg)
 {
-    _cleanup_close_ int dbfd = openat(repo->rootfd, repo_name,
-                                      O_CREAT | O_WRONLY | O_TRUNC, 0644);
-    if (dbfd < 0)
+    struct render_batch *batch = arg;
+    parallel_for(batch->count, config.jobs, render_one, batch);
+    return NULL;
+}
+
+static void start_thread(pthread_t *thread, void *(*fn)(void *), void *arg)
+{
+    int rc = pthread_create(thread, NULL, fn, arg);
+    if (rc != 0) {
+        errno = rc;
+        err(EXIT_FAILURE, "failed to create database thread");
+    }
+}
+
+static void render_release(struct render_batch *batch)
+{
+    for (size_t i = 0; i < batch->count; ++i) {
+        struct rendered *item = &batch->items[i];
+
+        /* Nothing else needs a file list read back from the old
+         * database, so don't hold on to it */
+        if (item->borrowed) {
+            filelist_free(item->pkg->files);
+            item->pkg->files = NULL;
+        }
+
+        for (int e = 0; e < ENTRY_MAX; ++e)
+            buffer_release(&item->entries[e]);
+        for (int o = 0; o < MAX_OUTPUTS; ++o) {
+            free(item->outputs[o].key);
+            buffer_release(&item->outputs[o].segment);
+        }
+    }
+    batch->count = 0;
+}
+
+static int write_batch(struct output *out, size_t idx, struct render_batch *batch)
+{
+    struct archive *archive = out->archive;
+    struct archive_entry *e = out->entry;
+
+    for (size_t i = 0; i < batch->count; ++i) {
+        struct rendered *item = &batch->items[i];
+
+        if (item->outputs[idx].cached) {
+            if (segwriter_reuse(&out->writer, item->outputs[idx].key,
+                                &item->outputs[idx].segment) < 0)
+                return -1;
+            continue;
+        }
+
+        _cleanup_free_ char *entrypath = joinstring(item->pkg->name, "-", item->pkg->version, NULL);
+
+        archive_entry_populate(e, AE_IFDIR, entrypath, 0755);
+        archive_write_header(archive, e);
+        archive_entry_clear(e);
+
+        for (int type = 0; type < ENTRY_MAX; ++type) {
+            if (out->contents & entry_types[type].member)
+                record_entry(archive, e, entrypath, entry_types[type].name, &item->entries[type]);
+        }
+
+        if (out->segmented) {
+            if (archive_write_finish_entry(archive) != ARCHIVE_OK)
+                return -1;
+            if (segwriter_cut(&out->writer, item->outputs[idx].key) < 0)
+                return -1;
+        }
+    }
+
+    return 0;
+}
+
+static int set_filter_option(struct archive *archive, const char *module,
+                             const char *option, int value)
+{
+    char buf[16];
+    snprintf(buf, sizeof(buf), "%d", value);
+
+    /* Older versions of libarchive don't know every option. That's
+     * fine, but a value they reject isn't. */
+    int status = archive_write_set_filter_option(archive, module, option, buf);
+    if (status == ARCHIVE_WARN) {
+        warnx("%s isn't supported by this libarchive, ignoring it", option);
+    } else if (status != ARCHIVE_OK) {
+        warnx("%s", archive_error_string(archive));
+        return status;
+    }
+    return ARCHIVE_OK;
+}
+
+static int set_filter_options(struct archive *archive)
+{
+    int status = ARCHIVE_OK;
+
+    if (config.compression_level)
+        status = set_filter_option(archive, NULL, "compression-level", config.compression_level);
+    if (status != ARCHIVE_OK)
+        return status;
+
+    switch (config.compression) {
+    case ARCHIVE_FILTER_XZ:
+        return set_filter_option(archive, "xz", "threads", config.threads);
+    case ARCHIVE_FILTER_ZSTD:
+        status = set_filter_option(archive, "zstd", "threads", config.threads);
+        if (status == ARCHIVE_OK && config.zstd_long)
+            status = set_filter_option(archive, "zstd", "long", config.zstd_long);
+        return status;
+    default:
+        return ARCHIVE_OK;
+    }
+}
+
+static int output_open(struct output *out, const struct repo *repo)
+{
+    /* Write next to the old database rather than over it: entries
+     * still get read back out of it, and a failed run shouldn't leave
+     * a truncated database behind */
+    out->tmpname = joinstring(out->name, ".tmp", NULL);
+    out->indexname = joinstring(out->name, ".segments", NULL);
+    out->oldfd = openat(repo->rootfd, out->name, O_RDONLY);
+    out->src = (struct db_source){ .fd = out->oldfd, .pkgcache = repo->cache };
+    out->archive = archive_write_new();
+    out->entry = archive_entry_new();
+
+    out->fd = openat(repo->rootfd, out->tmpname, O_CREAT | O_WRONLY | O_TRUNC, 0644);
+    if (out->fd < 0)
         return -1;
 
-    int ret = 0;
-    struct archive *archive = archive_write_new();
-    struct archive_entry *entry = archive_entry_new();
+    /* When the compression format allows it, compress every package
+     * separately and remember where each one went. Next time around,
+     * packages that haven't changed don't need compressing again.
+     * Long distance matching is only any use across the whole stream,
+     * so it's left to libarchive. */
+    out->segmented = segment_supported(config.compression) && !config.zstd_long;
+    out->writer = (struct segwriter){ .fd = out->fd };
 
-    archive_write_add_filter(archive, config.compression);
+    struct archive *archive = out->archive;
     archive_write_set_format_pax_restricted(archive);
 
-    if (archive_write_open_fd(archive, dbfd) < 0) {
-        ret = -1;
-        goto cleanup;
+    int status;
+    if (out->segmented) {
+        out->index = segindex_load(repo->rootfd, out->indexname, out->oldfd);
+        out->writer.next = segindex_new();
+
+        /* Unblocked, every entry reaches the segment writer as soon as
+         * it's finished */
+        archive_write_set_bytes_per_block(archive, 0);
+        archive_write_set_bytes_in_last_block(archive, 1);
+        status = archive_write_open(archive, &out->writer, NULL, segwriter_write, NULL);
+    } else {
+        archive_write_add_filter(archive, config.compression);
+        status = set_filter_options(archive);
+        if (status == ARCHIVE_OK)
+            status = archive_write_open_fd(archive, out->fd);
     }
 
-    archive_entry_populate(entry, AE_IFDIR, "", 0755);
-    archive_write_header(archive, entry);
-    archive_entry_clear(entry);
+    if (status != ARCHIVE_OK)
+        return -1;
 
-    struct buffer buf = {0};
+    archive_entry_populate(out->entry, AE_IFDIR, "", 0755);
+    archive_write_header(archive, out->entry);
+    archive_entry_clear(out->entry);
 
-    /* The files database can get very, very large. Lets preallocate
-     * a 2MiB buffer so we have plenty of room and avoid lots of
-     * rallocations. */
-    buffer_reserve(&buf, 0x200000);
+    if (out->segmented && segwriter_cut(&out->writer, NULL) < 0)
+        return -1;
+    return 0;
+}
+
+static int output_close(struct output *out, const struct repo *repo)
+{
+    int ret = out->status;
 
-    alpm_list_t *pkg, *pkgs = repo->cache->list;
-    for (pkg = pkgs; pkg; pkg = pkg->next) {
-        struct pkg *metadata = pkg->data;
-        compile_database_entry(archive, entry, metadata, what, &buf, repo->poolfd);
+    if (out->fd >= 0 && archive_write_close(out->archive) != ARCHIVE_OK)
+        ret = -1;
+    if (out->segmented && ret == 0) {
+        ret = segwriter_cut(&out->writer, NULL);
+        if (ret == 0)
+            ret = segwriter_flush(&out->writer);
     }
 
-    archive_write_close(archive);
-    buffer_release(&buf);
+    if (out->segmented && ret == 0)
+        trace("%s: reused %zu compressed packages, compressed %zu\n",
+              out->name, out->writer.reused, out->writer.compressed);
+
+    db_source_close(&out->src);
+    archive_entry_free(out->entry);
+    archive_write_free(out->archive);
+    segwriter_release(&out->writer);
+
+    if (ret == 0)
+        ret = renameat(repo->rootfd, out->tmpname, repo->rootfd, out->name);
+    if (ret < 0 && out->fd >= 0)
+        unlinkat(repo->rootfd, out->tmpname, 0);
+
+    /* Once replaced, the old database's index is no use */
+    if (ret == 0 && out->segmented) {
+        if (segindex_save(out->writer.next, repo->rootfd, out->indexname, out->fd) < 0)
+            warn("failed to write segment index %s", out->indexname);
+    } else if (ret == 0) {
+        unlinkat(repo->rootfd, out->indexname, 0);
+    }
 
-cleanup:
-    archive_entry_free(entry);
-    archive_write_free(archive);
+    segindex_free(out->index);
+    segindex_free(out->writer.next);
+    free(out->tmpname);
+    free(out->indexname);
+    if (out->fd >= 0)
+        close(out->fd);
+    if (out->oldfd >= 0)
+        close(out->oldfd);
     return ret;
 }
 
-int write_database(struct repo *repo, const char *repo_name, enum contents what)
+struct output_job {
+    struct output *out;
+    size_t idx;
+    struct render_batch *batch;
+};
+
+static void *output_main(void *arg)
+{
+    struct output_job *job = arg;
+
+    if (job->out->status == 0 && write_batch(job->out, job->idx, job->batch) < 0)
+        job->out->status = -1;
+    return NULL;
+}
+
+/* Each output is written, and for the most part compressed, on a
+ * thread of its own */
+static void write_outputs(struct output *outputs, size_t count, struct render_batch *batch)
+{
+    struct output_job jobs[MAX_OUTPUTS];
+
+    for (size_t o = 0; o < count; ++o) {
+        jobs[o] = (struct output_job){ .out = &outputs[o], .idx = o, .batch = batch };
+        if (o > 0)
+            start_thread(&outputs[o].thread, output_main, &jobs[o]);
+    }
+
+    output_main(&jobs[0]);
+
+    for (size_t o = 1; o < count; ++o)
+        pthread_join(outputs[o].thread, NULL);
+}
+
+static void compile_databases(struct repo *repo, struct output *outputs, size_t noutputs)
+{
+    size_t count = 0;
+    struct pkg *pkg;
+    _cleanup_free_ struct pkg **pkgs = calloc(repo->cache->entries + 1, sizeof(struct pkg *));
+    check_null(pkgs, "failed to allocate package list");
+    pkgcache_foreach(repo->cache, pkg)
+        pkgs[count++] = pkg;
+
+    for (size_t o = 0; o < noutputs; ++o) {
+        if (output_open(&outputs[o], repo) < 0)
+            outputs[o].status = -1;
+    }
+
+    /* Render the next batch while this one is written out. Writing
+     * keeps the calling thread busy compressing, or handing segments
+     * to the compression threads. */
+    struct render_batch *batches[2];
+    for (int b = 0; b < 2; ++b) {
+        batches[b] = calloc(1, sizeof(struct render_batch));
+        check_null(batches[b], "failed to allocate render queue");
+        batches[b]->repo = repo;
+    }
+
+    size_t next = render_prepare(batches[0], pkgs, count, 0, outputs, noutputs);
+    if (batches[0]->count)
+        start_thread(&batches[0]->thread, render_main, batches[0]);
+
+    for (int b = 0; batches[b]->count; b = !b) {
+        struct render_batch *batch = batches[b];
+        pthread_join(batch->thread, NULL);
+
+        if (next < count) {
+            next = render_prepare(batches[!b], pkgs, count, next, outputs, noutputs);
+            start_thread(&batches[!b]->thread, render_main, batches[!b]);
+        }
+
+        write_outputs(outputs, noutputs, batch);
+        render_release(batch);
+    }
+
+    free(batches[0]);
+    free(batches[1]);
+}
+
+/* Write the database, and the files database when there is one, in a
+ * single pass over the packages */
+int write_databases(struct repo *repo)
 {
-    trace("writing %s...\n", repo_name);
-    check_posix(compile_database(repo, repo_name, what),
-                "failed to write %s database", repo_name);
+    struct output outputs[MAX_OUTPUTS] = {
+        { .name = repo->dbname, .contents = DB_DESC | DB_DEPENDS, .fd = -1, .oldfd = -1 },
+        { .name = repo->filesname, .contents = DB_FILES, .fd = -1, .oldfd = -1 }
+    };
+    const size_t count = repo->filesname ? 2 : 1;
+
+    /* Keep the databases in name order. It also keeps the old ones and
+     * the new ones in step. */
+    pkgcache_sort(repo->cache);
+    compute_checksums(repo);
+
+    for (size_t o = 0; o < count; ++o)
+        trace("writing %s...\n", outputs[o].name);
+
+    compile_databases(repo, outputs, count);
+
+    int status[MAX_OUTPUTS];
+    for (size_t o = 0; o < count; ++o)
+        status[o] = output_close(&outputs[o], repo);
+
+    for (size_t o = 0; o < count; ++o) {
+        check_posix(status[o], "failed to write %s database", outputs[o].name);
 #ifdef REPOSE_SIGNING
-    if (config.sign)
-        gpgme_sign(repo->rootfd, repo_name, NULL);
+        if (config.sign)
+            gpgme_sign(repo->rootfd, outputs[o].name, NULL);
 #endif
+    }
     return 0;
 }
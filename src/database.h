@@ -1,8 +1,10 @@
 #pragma once
 
-#include "pkghash.h"
+#include "pkgcache.h"
 
 struct repo;
+struct arena;
+struct buffer;
 
 enum contents {
     DB_DESC    = 1,
@@ -10,5 +12,6 @@ enum contents {
     DB_FILES   = 1 << 3
 };
 
-int load_database(int fd, alpm_pkghash_t **pkgcache);
-int write_database(struct repo *repo, const char *repo_name, enum contents what);
+int load_database(int fd, struct pkgcache *pkgcache, struct arena *arena);
+int write_databases(struct repo *repo);
+void compile_package_metadata(struct pkg *pkg, struct buffer *buf);
@@ -2,19 +2,22 @@
 
 #include <stddef.h>
 #include <sys/types.h>
-#include <limits.h>
+#include <stdbool.h>
 #include "package.h"
+#include "buffer.h"
 
 struct archive;
 
 struct desc_parser {
     int cs;
     enum pkg_entry entry;
-    size_t pos;
-    char store[LINE_MAX];
+    const char *mark;
+    bool partial;
+    struct buffer spill;
 };
 
 void desc_parser_init(struct desc_parser *parser);
+void desc_parser_release(struct desc_parser *parser);
 ssize_t desc_parser_feed(struct desc_parser *parser, struct pkg *pkg,
                       char *buf, size_t buf_len);
 
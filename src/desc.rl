@@ -3,24 +3,31 @@
 #include <err.h>
 #include <archive.h>
 #include "package.h"
+#include "util.h"
 
 %%{
     machine desc;
 
-    action store {
-        parser->store[parser->pos++] = fc;
-        if (parser->pos == LINE_MAX) {
-            errx(1, "desc line too long");
-        }
+    action mark {
+        parser->mark = fpc;
     }
 
     action emit {
-        const char *entry = parser->store;
-        const size_t entry_len = parser->pos;
-        parser->store[parser->pos] = 0;
-        parser->pos = 0;
+        const char *entry = parser->mark;
+        size_t entry_len = fpc - parser->mark;
+
+        if (parser->partial) {
+            check_posix(buffer_append(&parser->spill, entry, entry_len),
+                        "failed to buffer desc value");
+            entry = parser->spill.data;
+            entry_len = parser->spill.len;
+        }
 
         package_set(pkg, parser->entry, entry, entry_len);
+
+        buffer_clear(&parser->spill);
+        parser->partial = false;
+        parser->mark = NULL;
     }
 
     header = '%FILENAME%'     %{ parser->entry = PKG_FILENAME; }
@@ -48,7 +55,7 @@
            | '%FILES%'        %{ parser->entry = PKG_FILES; };
 
       section = header '\n';
-      contents = [^%\n]+ @store %emit '\n';
+      contents = [^%\n]+ >mark %emit '\n';
 
       main := ( section contents* '\n' | '\n' )*;
 }%%
@@ -68,6 +75,11 @@ ssize_t desc_parser_feed(struct desc_parser *parser, struct pkg *pkg,
     char *p = buf;
     char *pe = p + buf_len;
 
+    /* Values are passed on as spans of the caller's buffer. One that
+     * was cut off at the end of the last buffer carries on here. */
+    if (parser->partial)
+        parser->mark = p;
+
     %%access parser->;
     %%write exec;
 
@@ -75,9 +87,21 @@ ssize_t desc_parser_feed(struct desc_parser *parser, struct pkg *pkg,
     if (parser->cs == desc_error)
         return -1;
 
+    if (parser->mark) {
+        check_posix(buffer_append(&parser->spill, parser->mark, pe - parser->mark),
+                    "failed to buffer desc value");
+        parser->partial = true;
+        parser->mark = NULL;
+    }
+
     return buf_len;
 }
 
+void desc_parser_release(struct desc_parser *parser)
+{
+    buffer_release(&parser->spill);
+}
+
 static int archive_read(struct archive *archive, char **buf, size_t *buf_len)
 {
     for (;;) {
@@ -93,14 +117,24 @@ static int archive_read(struct archive *archive, char **buf, size_t *buf_len)
 
 void read_desc(struct archive *archive, struct pkg *pkg)
 {
-    char *buf;
     struct desc_parser parser;
     desc_parser_init(&parser);
 
-     for (;;) {
-         size_t nbytes_r;
-         archive_read(archive, &buf, &nbytes_r);
-         desc_parser_feed(&parser, pkg, buf, nbytes_r);
-         break;
+    /* Entries can span any number of blocks; keep feeding the parser
+     * until the entry is exhausted */
+    for (;;) {
+        char *buf;
+        size_t nbytes_r;
+
+        int status = archive_read(archive, &buf, &nbytes_r);
+        if (status == ARCHIVE_EOF || status < ARCHIVE_WARN)
+            break;
+
+        if (desc_parser_feed(&parser, pkg, buf, nbytes_r) < 0) {
+            warnx("failed to parse desc entry");
+            break;
+        }
     }
+
+    desc_parser_release(&parser);
 }
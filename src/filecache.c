@@ -8,13 +8,43 @@
 #include <unistd.h>
 #include <dirent.h>
 #include <errno.h>
+#include <err.h>
+#include <sys/stat.h>
 #include <alpm.h>
 
 #include "package.h"
-#include "pkghash.h"
+#include "pkgcache.h"
 #include "filters.h"
+#include "fsops.h"
+#include "ingest.h"
+#include "scancache.h"
+#include "worker.h"
 #include "util.h"
 
+struct candidate {
+    char *filename;
+    char *name;
+    const char *version;
+    size_t order;
+    unsigned rank;
+};
+
+struct scan {
+    int dirfd;
+    int flags;
+    struct scancache *cache;
+    struct arena *arena;
+    alpm_list_t *targets;
+    const char *arch;
+    struct candidate *candidates;
+    struct stat *stats;
+    struct pkg **pkgs;
+
+    /* The candidates to load this round */
+    size_t *todo;
+    size_t pending;
+};
+
 static inline bool is_file(const struct dirent *dp)
 {
 #ifdef __QNX__
@@ -44,53 +74,192 @@ static inline bool is_file(const struct dirent *dp)
     }
     return false;
 #else
-    return dp->d_type == DT_REG || d_type == DT_UNKNOWN;
+    return dp->d_type == DT_REG || dp->d_type == DT_UNKNOWN;
 #endif
 }
 
-static inline alpm_pkghash_t *pkgcache_add(alpm_pkghash_t *cache, struct pkg *pkg)
+static inline void filecache_add(struct pkgcache *cache, struct pkg *pkg)
 {
-    struct pkg *old = _alpm_pkghash_find(cache, pkg->name);
+    struct pkg *old = pkgcache_find(cache, pkg->name);
     if (!old) {
-        return _alpm_pkghash_add(cache, pkg);
+        pkgcache_add(cache, pkg);
+        return;
     }
 
     int vercmp = alpm_pkg_vercmp(pkg->version, old->version);
     if (vercmp == 0 || vercmp == 1) {
-        return _alpm_pkghash_replace(cache, pkg, old);
+        pkgcache_replace(cache, pkg, old);
+        package_free(old);
+    } else {
+        package_free(pkg);
     }
-
-    return cache;
 }
 
-static size_t get_filecache_size(DIR *dirp)
+static char **get_filenames(DIR *dirp, size_t *count)
 {
     struct dirent *dp;
-    size_t size = 0;
+    size_t size = 0, buflen = 64;
+    char **filenames = malloc(buflen * sizeof(char *));
+    check_null(filenames, "failed to allocate filename list");
 
     for (dp = readdir(dirp); dp; dp = readdir(dirp)) {
-        if (is_file(dp))
-            ++size;
+        if (!is_file(dp))
+            continue;
+
+        if (size == buflen) {
+            buflen *= 2;
+            filenames = realloc(filenames, buflen * sizeof(char *));
+            check_null(filenames, "failed to allocate filename list");
+        }
+        filenames[size++] = strdup(dp->d_name);
+    }
+
+    *count = size;
+    return filenames;
+}
+
+static bool filter_candidate(char *filename, struct pkgfile *pkgfile,
+                             alpm_list_t *targets, const char *arch)
+{
+    if (parse_package_filename(filename, pkgfile) < 0)
+        return false;
+
+    if (arch && !streq(pkgfile->arch, arch) && !streq(pkgfile->arch, "any"))
+        goto reject;
+
+    if (targets) {
+        struct pkg stub = {
+            .filename = filename,
+            .name = pkgfile->name,
+            .version = pkgfile->version
+        };
+        if (!match_targets(&stub, targets))
+            goto reject;
+    }
+
+    return true;
+
+reject:
+    free(pkgfile->name);
+    return false;
+}
+
+static int candidate_cmp(const void *p1, const void *p2)
+{
+    const struct candidate *c1 = p1;
+    const struct candidate *c2 = p2;
+
+    int cmp = strcmp(c1->name, c2->name);
+    if (cmp == 0)
+        cmp = alpm_pkg_vercmp(c2->version, c1->version);
+    return cmp;
+}
+
+static int candidate_rankcmp(const void *p1, const void *p2)
+{
+    const struct candidate *c1 = p1;
+    const struct candidate *c2 = p2;
+
+    if (c1->rank != c2->rank)
+        return c1->rank < c2->rank ? -1 : 1;
+    return c1->order < c2->order ? -1 : c1->order > c2->order;
+}
+
+/* Use the name-pkgver-pkgrel-arch.pkg.tar.* naming convention to throw
+ * out files that aren't packages or are built for another architecture
+ * before paying for opening any archives. The rest are ranked by
+ * version within each name, newest first, with ties sharing a rank.
+ * Only the newest get loaded up front; an older one is only looked at
+ * if none of the newer ones turned out to be usable. Within a rank,
+ * directory order is kept. */
+static struct candidate *select_candidates(char **filenames, size_t *count,
+                                           alpm_list_t *targets, const char *arch)
+{
+    struct candidate *candidates = calloc(*count + 1, sizeof(struct candidate));
+    check_null(candidates, "failed to allocate candidates");
+
+    size_t i, kept = 0;
+    for (i = 0; i < *count; ++i) {
+        struct pkgfile pkgfile;
+        if (!filter_candidate(filenames[i], &pkgfile, targets, arch)) {
+            free(filenames[i]);
+            continue;
+        }
+
+        candidates[kept] = (struct candidate){
+            .filename = filenames[i],
+            .name = pkgfile.name,
+            .version = pkgfile.version,
+            .order = kept
+        };
+        ++kept;
+    }
+
+    qsort(candidates, kept, sizeof(struct candidate), candidate_cmp);
+    for (i = 1; i < kept; ++i) {
+        struct candidate *prev = &candidates[i - 1], *cur = &candidates[i];
+        if (!streq(cur->name, prev->name))
+            cur->rank = 0;
+        else if (alpm_pkg_vercmp(cur->version, prev->version) == 0)
+            cur->rank = prev->rank;
+        else
+            cur->rank = prev->rank + 1;
     }
+    qsort(candidates, kept, sizeof(struct candidate), candidate_rankcmp);
 
-    rewinddir(dirp);
-    return size;
+    *count = kept;
+    return candidates;
+}
+
+static bool has_signature(int dirfd, const char *filename)
+{
+    _cleanup_free_ char *signame = joinstring(filename, ".sig", NULL);
+    return faccessat(dirfd, signame, F_OK, 0) == 0;
 }
 
-static struct pkg *load_from_file(int dirfd, const char *filename)
+static struct pkg *load_package_file(struct scan *scan, const char *filename)
 {
-    _cleanup_close_ int pkgfd = openat(dirfd, filename, O_RDONLY);
+    const int dirfd = scan->dirfd;
+    int flags = scan->flags;
+
+    _cleanup_close_ int pkgfd = ingest_open(dirfd, filename);
     check_posix(pkgfd, "failed to open %s", filename);
 
-    struct pkg *pkg = malloc(sizeof(pkg_t));
-    *pkg = (struct pkg){ .filename = strdup(filename) };
+    struct pkg *pkg = package_new(scan->arena);
+    package_set(pkg, PKG_FILENAME, filename, strlen(filename));
+
+    /* Signed packages are recorded with their signature, not their
+     * checksum, so don't bother computing one */
+    if ((flags & PKG_LOAD_SHA256) && has_signature(dirfd, filename))
+        flags &= ~PKG_LOAD_SHA256;
 
-    if (load_package(pkg, pkgfd) < 0) {
+    if (load_package(pkg, pkgfd, PKG_LOAD_PKGINFO | flags) < 0) {
         package_free(pkg);
         return NULL;
     }
 
-    if (load_package_signature(pkg, dirfd) < 0 && errno != ENOENT) {
+    return pkg;
+}
+
+static struct pkg *load_from_file(struct scan *scan, size_t idx)
+{
+    const char *filename = scan->candidates[idx].filename;
+    struct pkg *pkg = NULL;
+
+    if (!scan->cache) {
+        pkg = load_package_file(scan, filename);
+    } else {
+        const struct stat *st = &scan->stats[idx];
+        if (!scancache_lookup(scan->cache, idx, filename, st, scan->arena, &pkg)) {
+            pkg = load_package_file(scan, filename);
+            scancache_store(scan->cache, idx, filename, st, pkg);
+        }
+    }
+
+    if (!pkg)
+        return NULL;
+
+    if (load_package_signature(pkg, scan->dirfd) < 0 && errno != ENOENT) {
         package_free(pkg);
         return NULL;
     }
@@ -98,36 +267,74 @@ static struct pkg *load_from_file(int dirfd, const char *filename)
     return pkg;
 }
 
-static alpm_pkghash_t *scan_for_targets(alpm_pkghash_t *cache, int dirfd, DIR *dirp,
-                                        alpm_list_t *targets, const char *arch)
+static void scan_for_target(size_t i, void *arg)
 {
-    const struct dirent *dp;
+    struct scan *scan = arg;
+    const size_t idx = scan->todo[i];
 
-    for (dp = readdir(dirp); dp; dp = readdir(dirp)) {
-        if (!is_file(dp))
-            continue;
+    struct pkg *pkg = load_from_file(scan, idx);
+    if (!pkg)
+        return;
 
-        struct pkg *pkg = load_from_file(dirfd, dp->d_name);
-        if (!pkg)
-            continue;
+    if (scan->targets && !match_targets(pkg, scan->targets)) {
+        package_free(pkg);
+        return;
+    }
 
-        if (targets && !match_targets(pkg, targets)) {
-            package_free(pkg);
-            continue;
-        }
+    if (scan->arch && !match_arch(pkg, scan->arch)) {
+        package_free(pkg);
+        return;
+    }
 
-        if (arch && !match_arch(pkg, arch)) {
-            package_free(pkg);
-            continue;
-        }
+    scan->pkgs[idx] = pkg;
+}
 
-        cache = pkgcache_add(cache, pkg);
+/* Checking candidates against the scan cache needs a stat of each,
+ * which can all go out in one batch before any worker starts */
+static void stat_candidates(struct scan *scan)
+{
+    _cleanup_free_ struct fsop *ops = calloc(scan->pending + 1, sizeof(struct fsop));
+    check_null(ops, "failed to allocate stat requests");
+
+    for (size_t i = 0; i < scan->pending; ++i) {
+        const size_t idx = scan->todo[i];
+        ops[i] = (struct fsop){
+            .type = FSOP_STAT,
+            .dirfd = scan->dirfd,
+            .path = scan->candidates[idx].filename,
+            .st = &scan->stats[idx]
+        };
     }
 
-    return cache;
+    fsops_run(ops, scan->pending);
+
+    for (size_t i = 0; i < scan->pending; ++i) {
+        if (ops[i].result < 0) {
+            errno = -ops[i].result;
+            err(EXIT_FAILURE, "failed to stat %s", ops[i].path);
+        }
+    }
+}
+
+static void scan_for_targets(struct pkgcache *cache, struct scan *scan, int jobs)
+{
+    if (scan->cache)
+        stat_candidates(scan);
+
+    parallel_for(scan->pending, jobs, scan_for_target, scan);
+
+    /* Merge in directory order so the result is identical to a serial
+     * scan no matter which worker finished first. */
+    for (size_t i = 0; i < scan->pending; ++i) {
+        struct pkg *pkg = scan->pkgs[scan->todo[i]];
+        if (pkg)
+            filecache_add(cache, pkg);
+    }
 }
 
-alpm_pkghash_t *get_filecache(int dirfd, alpm_list_t *targets, const char *arch)
+struct pkgcache *get_filecache(int dirfd, alpm_list_t *targets, const char *arch,
+                               int flags, int jobs, struct scancache *scancache,
+                               struct arena *arena)
 {
     int dupfd = dup(dirfd);
     check_posix(dupfd, "failed to duplicate fd");
@@ -140,8 +347,57 @@ alpm_pkghash_t *get_filecache(int dirfd, alpm_list_t *targets, const char *arch)
     dircntl(dirp, D_SETFLAG, D_FLAG_STAT);
 #endif
 
-    size_t size = get_filecache_size(dirp);
-    alpm_pkghash_t *cache = _alpm_pkghash_create(size);
+    size_t count;
+    _cleanup_free_ char **filenames = get_filenames(dirp, &count);
+
+    if (scancache)
+        scancache_prune(scancache, filenames, count);
+
+    struct scan scan = {
+        .dirfd = dirfd,
+        .flags = flags,
+        .cache = scancache,
+        .arena = arena,
+        .targets = targets,
+        .arch = arch,
+        .candidates = select_candidates(filenames, &count, targets, arch)
+    };
+
+    scan.pkgs = calloc(count + 1, sizeof(struct pkg *));
+    check_null(scan.pkgs, "failed to allocate filecache");
+    scan.todo = calloc(count + 1, sizeof(size_t));
+    check_null(scan.todo, "failed to allocate filecache");
 
-    return scan_for_targets(cache, dirfd, dirp, targets, arch);
+    if (scancache) {
+        scancache_begin(scancache, count);
+        scan.stats = calloc(count + 1, sizeof(struct stat));
+        check_null(scan.stats, "failed to allocate stat results");
+    }
+
+    struct pkgcache *cache = pkgcache_new(count);
+
+    /* Load a rank at a time, skipping names a newer rank already
+     * produced a package for */
+    for (size_t first = 0, last; first < count; first = last) {
+        const unsigned rank = scan.candidates[first].rank;
+
+        scan.pending = 0;
+        for (last = first; last < count && scan.candidates[last].rank == rank; ++last) {
+            if (rank == 0 || !pkgcache_find(cache, scan.candidates[last].name))
+                scan.todo[scan.pending++] = last;
+        }
+
+        scan_for_targets(cache, &scan, jobs);
+    }
+
+    for (size_t i = 0; i < count; ++i) {
+        free(scan.candidates[i].filename);
+        free(scan.candidates[i].name);
+    }
+    free(scan.candidates);
+    free(scan.stats);
+    free(scan.pkgs);
+    free(scan.todo);
+
+    return cache;
 }
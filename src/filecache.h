@@ -1,6 +1,11 @@
 #pragma once
 
 #include <alpm_list.h>
-#include "pkghash.h"
+#include "pkgcache.h"
 
-alpm_pkghash_t *get_filecache(int dirfd, alpm_list_t *targets, const char *arch);
+struct scancache;
+struct arena;
+
+struct pkgcache *get_filecache(int dirfd, alpm_list_t *targets, const char *arch,
+                               int flags, int jobs, struct scancache *scancache,
+                               struct arena *arena);
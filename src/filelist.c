@@ -0,0 +1,183 @@
+#include "filelist.h"
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+
+#include "buffer.h"
+#include "util.h"
+
+#define RESTART_INTERVAL 16
+
+struct filelist {
+    unsigned char *data;
+    size_t len;
+    size_t size;
+
+    uint32_t *restarts;
+    size_t restarts_size;
+    size_t count;
+
+    /* The last path added, needed to front-code the next one */
+    char *last;
+    size_t last_len;
+    size_t last_size;
+};
+
+static size_t put_varint(unsigned char *out, size_t val)
+{
+    size_t n = 0;
+    while (val >= 0x80) {
+        out[n++] = (val & 0x7f) | 0x80;
+        val >>= 7;
+    }
+    out[n++] = val;
+    return n;
+}
+
+static size_t get_varint(const unsigned char *in, size_t *val)
+{
+    size_t n = 0, shift = 0;
+    *val = 0;
+    do {
+        *val |= (size_t)(in[n] & 0x7f) << shift;
+        shift += 7;
+    } while (in[n++] & 0x80);
+    return n;
+}
+
+static void *grow(void *ptr, size_t *size, size_t want, size_t elem)
+{
+    if (want <= *size)
+        return ptr;
+
+    size_t newsize = *size ? *size : 64;
+    while (newsize < want)
+        newsize *= 2;
+
+    ptr = realloc(ptr, newsize * elem);
+    check_null(ptr, "failed to allocate file list");
+    *size = newsize;
+    return ptr;
+}
+
+struct filelist *filelist_new(void)
+{
+    struct filelist *list = calloc(1, sizeof(struct filelist));
+    check_null(list, "failed to allocate file list");
+    return list;
+}
+
+void filelist_free(struct filelist *list)
+{
+    if (!list)
+        return;
+
+    free(list->data);
+    free(list->restarts);
+    free(list->last);
+    free(list);
+}
+
+void filelist_add(struct filelist *list, const char *path, size_t len)
+{
+    size_t shared = 0;
+
+    if (list->count % RESTART_INTERVAL == 0) {
+        list->restarts = grow(list->restarts, &list->restarts_size,
+                              list->count / RESTART_INTERVAL + 1, sizeof(uint32_t));
+        list->restarts[list->count / RESTART_INTERVAL] = list->len;
+    } else {
+        const size_t max = len < list->last_len ? len : list->last_len;
+        while (shared < max && path[shared] == list->last[shared])
+            ++shared;
+    }
+
+    const size_t unshared = len - shared;
+
+    /* Two varints of at most 10 bytes each, then the suffix */
+    list->data = grow(list->data, &list->size, list->len + 20 + unshared, 1);
+    list->len += put_varint(&list->data[list->len], shared);
+    list->len += put_varint(&list->data[list->len], unshared);
+    memcpy(&list->data[list->len], path + shared, unshared);
+    list->len += unshared;
+
+    list->last = grow(list->last, &list->last_size, len + 1, 1);
+    memcpy(list->last + shared, path + shared, unshared);
+    list->last[len] = '\0';
+    list->last_len = len;
+
+    ++list->count;
+}
+
+size_t filelist_count(const struct filelist *list)
+{
+    return list ? list->count : 0;
+}
+
+size_t filelist_size(const struct filelist *list)
+{
+    return list ? list->len : 0;
+}
+
+/* Decode the entry at pos. Its first shared bytes come from the
+ * previous path, which the caller keeps. Returns the position of the
+ * next entry. */
+static size_t decode_entry(const struct filelist *list, size_t pos,
+                           size_t *shared, const unsigned char **suffix, size_t *unshared)
+{
+    pos += get_varint(&list->data[pos], shared);
+    pos += get_varint(&list->data[pos], unshared);
+    *suffix = &list->data[pos];
+    return pos + *unshared;
+}
+
+int filelist_get(const struct filelist *list, size_t idx, struct buffer *buf)
+{
+    if (!list || idx >= list->count) {
+        errno = ERANGE;
+        return -1;
+    }
+
+    size_t pos = list->restarts[idx / RESTART_INTERVAL];
+    buffer_clear(buf);
+
+    for (size_t i = idx - idx % RESTART_INTERVAL; i <= idx; ++i) {
+        size_t shared, unshared;
+        const unsigned char *suffix;
+        pos = decode_entry(list, pos, &shared, &suffix, &unshared);
+
+        if (buffer_reserve(buf, shared + unshared + 1) < 0)
+            return -1;
+        memcpy(&buf->data[shared], suffix, unshared);
+        buf->len = shared + unshared;
+        buf->data[buf->len] = '\0';
+    }
+
+    return 0;
+}
+
+void filelist_write(const struct filelist *list, struct buffer *buf)
+{
+    size_t pos = 0, prev = 0;
+
+    for (size_t i = 0; i < list->count; ++i) {
+        size_t shared, unshared;
+        const unsigned char *suffix;
+        pos = decode_entry(list, pos, &shared, &suffix, &unshared);
+
+        /* The previous path was just written out, so copy the shared
+         * prefix from there rather than keeping a scratch copy. Room
+         * for the path, its newline and the terminator. */
+        check_posix(buffer_reserve(buf, shared + unshared + 2),
+                    "failed to allocate file list");
+        const size_t start = buf->len;
+        memmove(&buf->data[start], &buf->data[prev], shared);
+        memcpy(&buf->data[start + shared], suffix, unshared);
+        buf->len += shared + unshared;
+        buf->data[buf->len++] = '\n';
+        buf->data[buf->len] = '\0';
+        prev = start;
+    }
+}
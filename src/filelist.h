@@ -0,0 +1,24 @@
+#pragma once
+
+#include <stddef.h>
+
+struct buffer;
+
+/* A package's file list, stored as a single block of front-coded
+ * paths: each entry only records the bytes it doesn't share with the
+ * previous one. Every 16th entry is stored whole and indexed so a
+ * lookup doesn't have to decode from the start. */
+struct filelist;
+
+struct filelist *filelist_new(void);
+void filelist_free(struct filelist *list);
+
+void filelist_add(struct filelist *list, const char *path, size_t len);
+size_t filelist_count(const struct filelist *list);
+size_t filelist_size(const struct filelist *list);
+
+/* Decode entry idx into buf, replacing its contents */
+int filelist_get(const struct filelist *list, size_t idx, struct buffer *buf);
+
+/* Append every path to buf, one per line */
+void filelist_write(const struct filelist *list, struct buffer *buf);
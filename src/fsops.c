@@ -0,0 +1,316 @@
+#include "fsops.h"
+
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <errno.h>
+#include <err.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#ifdef REPOSE_IO_URING
+#include <stdint.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/sysmacros.h>
+#include <linux/io_uring.h>
+#endif
+
+#include "util.h"
+
+static int fsop_sync(struct fsop *op)
+{
+    struct stat st;
+    int ret;
+
+    switch (op->type) {
+    case FSOP_STAT:
+        ret = fstatat(op->dirfd, op->path, op->st ? op->st : &st, op->flags);
+        break;
+    case FSOP_UNLINK:
+        ret = unlinkat(op->dirfd, op->path, op->flags);
+        break;
+    case FSOP_SYMLINK:
+        ret = symlinkat(op->path, op->newdirfd, op->newpath);
+        break;
+    case FSOP_LINK:
+        ret = linkat(op->dirfd, op->path, op->newdirfd, op->newpath, op->flags);
+        break;
+    default:
+        errno = EINVAL;
+        ret = -1;
+        break;
+    }
+
+    return ret < 0 ? -errno : 0;
+}
+
+#ifdef REPOSE_IO_URING
+
+/* Enough to keep a network filesystem busy without holding more than
+ * a handful of requests against it at once */
+#define FSOPS_QUEUE_DEPTH 64
+
+/* Setting up a ring costs a few syscalls of its own */
+#define FSOPS_MIN_BATCH 8
+
+static const uint8_t opcodes[] = {
+    [FSOP_STAT]    = IORING_OP_STATX,
+    [FSOP_UNLINK]  = IORING_OP_UNLINKAT,
+    [FSOP_SYMLINK] = IORING_OP_SYMLINKAT,
+    [FSOP_LINK]    = IORING_OP_LINKAT
+};
+
+struct uring {
+    int fd;
+    unsigned depth;
+    bool supported[sizeof(opcodes)];
+
+    void *sq_ring;
+    void *cq_ring;
+    size_t sq_ring_size;
+    size_t cq_ring_size;
+    struct io_uring_sqe *sqes;
+    size_t sqes_size;
+
+    unsigned *sq_head;
+    unsigned *sq_tail;
+    unsigned *sq_mask;
+    unsigned *sq_array;
+    unsigned *cq_head;
+    unsigned *cq_tail;
+    unsigned *cq_mask;
+    struct io_uring_cqe *cqes;
+
+    /* Statx results land in a slot per request in flight */
+    struct statx statx[FSOPS_QUEUE_DEPTH];
+    unsigned slots[FSOPS_QUEUE_DEPTH];
+    unsigned free_slots;
+};
+
+static void uring_teardown(struct uring *ring)
+{
+    if (ring->sqes && ring->sqes != MAP_FAILED)
+        munmap(ring->sqes, ring->sqes_size);
+    if (ring->cq_ring && ring->cq_ring != MAP_FAILED && ring->cq_ring != ring->sq_ring)
+        munmap(ring->cq_ring, ring->cq_ring_size);
+    if (ring->sq_ring && ring->sq_ring != MAP_FAILED)
+        munmap(ring->sq_ring, ring->sq_ring_size);
+    close(ring->fd);
+}
+
+/* Ask which operations this kernel's io_uring can do. Anything it
+ * can't is run synchronously instead. */
+static bool uring_probe(struct uring *ring)
+{
+    const size_t nops = 256;
+    _cleanup_free_ struct io_uring_probe *probe =
+        calloc(1, sizeof(struct io_uring_probe) + nops * sizeof(struct io_uring_probe_op));
+    if (!probe)
+        return false;
+
+    if (syscall(__NR_io_uring_register, ring->fd, IORING_REGISTER_PROBE, probe, nops) < 0)
+        return false;
+
+    bool any = false;
+    for (size_t i = 0; i < sizeof(opcodes); ++i) {
+        ring->supported[i] = opcodes[i] <= probe->last_op &&
+            (probe->ops[opcodes[i]].flags & IO_URING_OP_SUPPORTED);
+        any |= ring->supported[i];
+    }
+
+    return any;
+}
+
+static int uring_setup(struct uring *ring, unsigned entries)
+{
+    struct io_uring_params params = {0};
+
+    *ring = (struct uring){0};
+    ring->fd = syscall(__NR_io_uring_setup, entries, &params);
+    if (ring->fd < 0)
+        return -1;
+
+    ring->sq_ring_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    ring->cq_ring_size = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    if (params.features & IORING_FEAT_SINGLE_MMAP) {
+        if (ring->cq_ring_size > ring->sq_ring_size)
+            ring->sq_ring_size = ring->cq_ring_size;
+        ring->cq_ring_size = ring->sq_ring_size;
+    }
+
+    ring->sq_ring = mmap(NULL, ring->sq_ring_size, PROT_READ | PROT_WRITE,
+                         MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQ_RING);
+    if (ring->sq_ring == MAP_FAILED)
+        goto fail;
+
+    if (params.features & IORING_FEAT_SINGLE_MMAP) {
+        ring->cq_ring = ring->sq_ring;
+    } else {
+        ring->cq_ring = mmap(NULL, ring->cq_ring_size, PROT_READ | PROT_WRITE,
+                             MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_CQ_RING);
+        if (ring->cq_ring == MAP_FAILED)
+            goto fail;
+    }
+
+    ring->sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+    ring->sqes = mmap(NULL, ring->sqes_size, PROT_READ | PROT_WRITE,
+                      MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQES);
+    if (ring->sqes == MAP_FAILED)
+        goto fail;
+
+    char *sq = ring->sq_ring, *cq = ring->cq_ring;
+    ring->sq_head  = (unsigned *)(sq + params.sq_off.head);
+    ring->sq_tail  = (unsigned *)(sq + params.sq_off.tail);
+    ring->sq_mask  = (unsigned *)(sq + params.sq_off.ring_mask);
+    ring->sq_array = (unsigned *)(sq + params.sq_off.array);
+    ring->cq_head  = (unsigned *)(cq + params.cq_off.head);
+    ring->cq_tail  = (unsigned *)(cq + params.cq_off.tail);
+    ring->cq_mask  = (unsigned *)(cq + params.cq_off.ring_mask);
+    ring->cqes     = (struct io_uring_cqe *)(cq + params.cq_off.cqes);
+
+    if (!uring_probe(ring))
+        goto fail;
+
+    ring->depth = params.sq_entries < FSOPS_QUEUE_DEPTH ? params.sq_entries : FSOPS_QUEUE_DEPTH;
+    for (unsigned i = 0; i < ring->depth; ++i)
+        ring->slots[i] = i;
+    ring->free_slots = ring->depth;
+    return 0;
+
+fail:
+    uring_teardown(ring);
+    return -1;
+}
+
+static void statx_to_stat(const struct statx *stx, struct stat *st)
+{
+    *st = (struct stat){
+        .st_dev = makedev(stx->stx_dev_major, stx->stx_dev_minor),
+        .st_ino = stx->stx_ino,
+        .st_mode = stx->stx_mode,
+        .st_nlink = stx->stx_nlink,
+        .st_uid = stx->stx_uid,
+        .st_gid = stx->stx_gid,
+        .st_rdev = makedev(stx->stx_rdev_major, stx->stx_rdev_minor),
+        .st_size = stx->stx_size,
+        .st_blksize = stx->stx_blksize,
+        .st_blocks = stx->stx_blocks,
+        .st_atim = { stx->stx_atime.tv_sec, stx->stx_atime.tv_nsec },
+        .st_mtim = { stx->stx_mtime.tv_sec, stx->stx_mtime.tv_nsec },
+        .st_ctim = { stx->stx_ctime.tv_sec, stx->stx_ctime.tv_nsec }
+    };
+}
+
+static void uring_prep(struct io_uring_sqe *sqe, const struct fsop *op, struct statx *stx)
+{
+    *sqe = (struct io_uring_sqe){
+        .opcode = opcodes[op->type],
+        .addr = (uintptr_t)op->path
+    };
+
+    switch (op->type) {
+    case FSOP_STAT:
+        sqe->fd = op->dirfd;
+        sqe->len = STATX_BASIC_STATS;
+        sqe->off = (uintptr_t)stx;
+        sqe->statx_flags = op->flags;
+        break;
+    case FSOP_UNLINK:
+        sqe->fd = op->dirfd;
+        sqe->unlink_flags = op->flags;
+        break;
+    case FSOP_SYMLINK:
+        sqe->fd = op->newdirfd;
+        sqe->addr2 = (uintptr_t)op->newpath;
+        break;
+    case FSOP_LINK:
+        sqe->fd = op->dirfd;
+        sqe->len = op->newdirfd;
+        sqe->addr2 = (uintptr_t)op->newpath;
+        sqe->hardlink_flags = op->flags;
+        break;
+    }
+}
+
+/* Requests carry their index into ops and their statx slot back with
+ * them in user_data */
+static void uring_reap(struct uring *ring, struct fsop *ops, size_t *pending)
+{
+    unsigned head = *ring->cq_head;
+    const unsigned tail = __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE);
+
+    for (; head != tail; ++head) {
+        const struct io_uring_cqe *cqe = &ring->cqes[head & *ring->cq_mask];
+        const size_t idx = cqe->user_data >> 16;
+        const unsigned slot = cqe->user_data & 0xffff;
+        struct fsop *op = &ops[idx];
+
+        op->result = cqe->res;
+        if (op->type == FSOP_STAT && op->result == 0 && op->st)
+            statx_to_stat(&ring->statx[slot], op->st);
+
+        ring->slots[ring->free_slots++] = slot;
+        --*pending;
+    }
+
+    __atomic_store_n(ring->cq_head, head, __ATOMIC_RELEASE);
+}
+
+static void uring_run(struct uring *ring, struct fsop *ops, size_t count)
+{
+    size_t next = 0, pending = 0;
+
+    while (next < count || pending) {
+        unsigned tail = *ring->sq_tail;
+
+        while (next < count && ring->free_slots) {
+            struct fsop *op = &ops[next];
+            if (!ring->supported[op->type]) {
+                op->result = fsop_sync(op);
+                ++next;
+                continue;
+            }
+
+            const unsigned slot = ring->slots[--ring->free_slots];
+            const unsigned idx = tail & *ring->sq_mask;
+            uring_prep(&ring->sqes[idx], op, &ring->statx[slot]);
+            ring->sqes[idx].user_data = (uint64_t)next << 16 | slot;
+            ring->sq_array[idx] = idx;
+
+            ++tail;
+            ++pending;
+            ++next;
+        }
+
+        __atomic_store_n(ring->sq_tail, tail, __ATOMIC_RELEASE);
+        if (!pending)
+            continue;
+
+        const unsigned submit = tail - __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE);
+        if (syscall(__NR_io_uring_enter, ring->fd, submit, 1,
+                    IORING_ENTER_GETEVENTS, NULL, 0) < 0 && errno != EINTR)
+            err(EXIT_FAILURE, "failed to submit to io_uring");
+
+        uring_reap(ring, ops, &pending);
+    }
+}
+
+#endif
+
+void fsops_run(struct fsop *ops, size_t count)
+{
+#ifdef REPOSE_IO_URING
+    if (count >= FSOPS_MIN_BATCH) {
+        struct uring ring;
+        if (uring_setup(&ring, FSOPS_QUEUE_DEPTH) == 0) {
+            uring_run(&ring, ops, count);
+            uring_teardown(&ring);
+            return;
+        }
+    }
+#endif
+
+    for (size_t i = 0; i < count; ++i)
+        ops[i].result = fsop_sync(&ops[i]);
+}
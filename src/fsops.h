@@ -0,0 +1,38 @@
+#pragma once
+
+#include <stddef.h>
+#include <sys/stat.h>
+
+/* Filesystem operations issued in bulk. When built with
+ * REPOSE_IO_URING and the kernel allows it, a batch is pushed through
+ * an io_uring a bounded number at a time, rather than paying a full
+ * syscall round trip for each, which adds up on network filesystems.
+ * Otherwise, and for any operation the kernel's io_uring doesn't know,
+ * the same calls are made one by one, with the same results. */
+enum fsop_type {
+    FSOP_STAT,
+    FSOP_UNLINK,
+    FSOP_SYMLINK,
+    FSOP_LINK
+};
+
+struct fsop {
+    enum fsop_type type;
+
+    /* FSOP_STAT, FSOP_UNLINK: fstatat() and unlinkat() on path
+     * FSOP_SYMLINK: symlinkat() of a link at newpath pointing to path
+     * FSOP_LINK: linkat() from path to newpath */
+    int dirfd;
+    const char *path;
+    int newdirfd;
+    const char *newpath;
+    int flags;
+
+    /* Filled in by FSOP_STAT, if not NULL */
+    struct stat *st;
+
+    /* 0, or a negated errno */
+    int result;
+};
+
+void fsops_run(struct fsop *ops, size_t count);
@@ -0,0 +1,140 @@
+#include "ingest.h"
+
+#include <stdlib.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "mapping.h"
+#include "util.h"
+
+/* How much of a package to look at when deciding whether it's already
+ * cached, and to read when only its .PKGINFO is wanted */
+#define INGEST_HEAD (2 * READ_BLOCK_SIZE)
+
+/* Past this, leave reading ahead to the kernel's sequential heuristics */
+#define INGEST_READAHEAD (16 * READ_BLOCK_SIZE)
+
+static bool noatime;
+static size_t max_inflight;
+static size_t inflight;
+static pthread_mutex_t inflight_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t inflight_cond = PTHREAD_COND_INITIALIZER;
+
+/* A max_inflight of 0 leaves reads unlimited */
+void ingest_configure(bool use_noatime, size_t limit)
+{
+    noatime = use_noatime;
+    max_inflight = limit;
+}
+
+/* O_NOATIME spares a metadata write for every package read, but only
+ * the owner of a file may ask for it */
+int ingest_open(int dirfd, const char *filename)
+{
+    if (noatime) {
+        int fd = openat(dirfd, filename, O_RDONLY | O_NOATIME);
+        if (fd >= 0 || errno != EPERM)
+            return fd;
+    }
+
+    return openat(dirfd, filename, O_RDONLY);
+}
+
+/* Someone else is reading this file if any of its head is resident.
+ * Mapping it without touching it is enough to ask. */
+static bool is_cached(int fd, size_t len)
+{
+    const size_t window = len < INGEST_HEAD ? len : INGEST_HEAD;
+    if (window == 0)
+        return false;
+
+    void *data = mmap(NULL, window, PROT_READ, MAP_SHARED, fd, 0);
+    if (data == MAP_FAILED)
+        return false;
+
+    const size_t pagesize = sysconf(_SC_PAGESIZE);
+    const size_t pages = (window + pagesize - 1) / pagesize;
+    unsigned char vec[INGEST_HEAD / 4096 + 1];
+
+    bool cached = false;
+    if (pages <= sizeof(vec) && mincore(data, window, vec) == 0) {
+        for (size_t i = 0; i < pages && !cached; ++i)
+            cached = vec[i] & 1;
+    }
+
+    munmap(data, window);
+    return cached;
+}
+
+/* A file bigger than the whole budget still gets read, just alone */
+static void inflight_reserve(struct ingest *in, size_t want)
+{
+    if (!max_inflight)
+        return;
+    if (want > max_inflight)
+        want = max_inflight;
+
+    pthread_mutex_lock(&inflight_lock);
+    while (inflight && inflight + want > max_inflight)
+        pthread_cond_wait(&inflight_cond, &inflight_lock);
+    inflight += want;
+    pthread_mutex_unlock(&inflight_lock);
+
+    in->reserved = want;
+}
+
+static void inflight_release(struct ingest *in)
+{
+    if (!in->reserved)
+        return;
+
+    pthread_mutex_lock(&inflight_lock);
+    inflight -= in->reserved;
+    pthread_cond_broadcast(&inflight_cond);
+    pthread_mutex_unlock(&inflight_lock);
+
+    in->reserved = 0;
+}
+
+/* Get ready to read a package, either whole or just its head. Waits
+ * for room under the in-flight cap, if there is one. */
+void ingest_begin(struct ingest *in, int fd, bool whole)
+{
+    struct stat st;
+
+    *in = (struct ingest){ .fd = -1 };
+    if (fstat(fd, &st) < 0 || !S_ISREG(st.st_mode))
+        return;
+
+    in->fd = fd;
+    in->len = st.st_size;
+
+    const size_t want = whole || in->len < INGEST_HEAD ? in->len : INGEST_HEAD;
+    inflight_reserve(in, want);
+    in->cached = is_cached(fd, in->len);
+
+    posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+#ifdef __linux__
+    readahead(fd, 0, want < INGEST_READAHEAD ? want : INGEST_READAHEAD);
+#else
+    posix_fadvise(fd, 0, want < INGEST_READAHEAD ? want : INGEST_READAHEAD, POSIX_FADV_WILLNEED);
+#endif
+}
+
+/* Must only be called once nothing maps the file anymore, or its pages
+ * can't be dropped */
+void ingest_end(struct ingest *in)
+{
+    if (in->fd < 0)
+        return;
+
+    if (!in->cached)
+        posix_fadvise(in->fd, 0, 0, POSIX_FADV_DONTNEED);
+
+    inflight_release(in);
+    in->fd = -1;
+}
@@ -0,0 +1,23 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+
+/* Every package in the pool is read once, front to back, and then
+ * never again. Tell the kernel as much, and keep a full scan from
+ * pushing whatever else the host is serving out of the page cache:
+ * pages a read brought in are dropped again afterwards, unless the
+ * file was already cached to begin with. The number of bytes being
+ * read at once across all workers can also be capped. */
+struct ingest {
+    int fd;
+    size_t len;
+    size_t reserved;
+    bool cached;
+};
+
+void ingest_configure(bool noatime, size_t max_inflight);
+
+int ingest_open(int dirfd, const char *filename);
+void ingest_begin(struct ingest *in, int fd, bool whole);
+void ingest_end(struct ingest *in);
@@ -0,0 +1,174 @@
+#include "intern.h"
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <pthread.h>
+
+#include "arena.h"
+#include "util.h"
+
+/* Split the table into shards by hash so parallel loaders rarely wait
+ * on each other */
+#define SHARDS 16
+
+struct slot {
+    uint64_t hash;
+    char *str;
+};
+
+struct shard {
+    pthread_mutex_t lock;
+    struct arena *arena;
+    struct slot *slots;
+    size_t capacity;
+    size_t used;
+    struct intern_stats stats;
+};
+
+static struct shard shards[SHARDS];
+static pthread_once_t shards_once = PTHREAD_ONCE_INIT;
+
+static void shards_init(void)
+{
+    for (size_t i = 0; i < SHARDS; ++i)
+        pthread_mutex_init(&shards[i].lock, NULL);
+}
+
+/* Strings are stored with their length in front, so a probe can reject
+ * a mismatch without scanning it */
+static inline uint32_t string_len(const char *str)
+{
+    uint32_t len;
+    memcpy(&len, str - sizeof(uint32_t), sizeof(uint32_t));
+    return len;
+}
+
+static uint64_t hash_string(const char *str, size_t len)
+{
+    uint64_t hash = 0xcbf29ce484222325ULL;
+    for (size_t i = 0; i < len; ++i) {
+        hash ^= (unsigned char)str[i];
+        hash *= 0x100000001b3ULL;
+    }
+    hash ^= hash >> 33;
+    hash *= 0xff51afd7ed558ccdULL;
+    hash ^= hash >> 33;
+    return hash;
+}
+
+static void shard_insert(struct shard *shard, uint64_t hash, char *str)
+{
+    size_t mask = shard->capacity - 1;
+    size_t idx = hash & mask;
+    while (shard->slots[idx].str)
+        idx = (idx + 1) & mask;
+
+    shard->slots[idx] = (struct slot){ .hash = hash, .str = str };
+    shard->used++;
+}
+
+static void shard_grow(struct shard *shard)
+{
+    struct slot *old = shard->slots;
+    size_t capacity = shard->capacity;
+
+    shard->capacity = capacity ? capacity * 2 : 256;
+    shard->slots = calloc(shard->capacity, sizeof(struct slot));
+    check_null(shard->slots, "failed to allocate string table");
+    shard->used = 0;
+
+    for (size_t i = 0; i < capacity; ++i) {
+        if (old[i].str)
+            shard_insert(shard, old[i].hash, old[i].str);
+    }
+    free(old);
+}
+
+static char *shard_lookup(struct shard *shard, uint64_t hash, const char *str, size_t len)
+{
+    if (!shard->capacity)
+        return NULL;
+
+    size_t mask = shard->capacity - 1;
+    for (size_t idx = hash & mask; shard->slots[idx].str; idx = (idx + 1) & mask) {
+        const struct slot *slot = &shard->slots[idx];
+        if (slot->hash == hash && string_len(slot->str) == len &&
+            memcmp(slot->str, str, len) == 0)
+            return slot->str;
+    }
+
+    return NULL;
+}
+
+char *intern(const char *str, size_t len)
+{
+    pthread_once(&shards_once, shards_init);
+    len = strnlen(str, len);
+
+    const uint64_t hash = hash_string(str, len);
+    struct shard *shard = &shards[hash >> 60];
+
+    pthread_mutex_lock(&shard->lock);
+    shard->stats.lookups++;
+
+    char *interned = shard_lookup(shard, hash, str, len);
+    if (interned) {
+        shard->stats.hits++;
+        shard->stats.saved += len + 1;
+        pthread_mutex_unlock(&shard->lock);
+        return interned;
+    }
+
+    if (!shard->arena)
+        shard->arena = arena_new();
+    if (2 * (shard->used + 1) > shard->capacity)
+        shard_grow(shard);
+
+    const uint32_t prefix = len;
+    char *block = arena_alloc(shard->arena, sizeof(uint32_t) + len + 1);
+    memcpy(block, &prefix, sizeof(uint32_t));
+    interned = block + sizeof(uint32_t);
+    memcpy(interned, str, len);
+    interned[len] = '\0';
+
+    shard_insert(shard, hash, interned);
+    shard->stats.strings++;
+    shard->stats.bytes += len + 1;
+
+    pthread_mutex_unlock(&shard->lock);
+    return interned;
+}
+
+void intern_stats(struct intern_stats *stats)
+{
+    pthread_once(&shards_once, shards_init);
+    *stats = (struct intern_stats){0};
+
+    for (size_t i = 0; i < SHARDS; ++i) {
+        struct shard *shard = &shards[i];
+        pthread_mutex_lock(&shard->lock);
+        stats->lookups += shard->stats.lookups;
+        stats->hits += shard->stats.hits;
+        stats->strings += shard->stats.strings;
+        stats->bytes += shard->stats.bytes;
+        stats->saved += shard->stats.saved;
+        pthread_mutex_unlock(&shard->lock);
+    }
+}
+
+void intern_release(void)
+{
+    pthread_once(&shards_once, shards_init);
+    for (size_t i = 0; i < SHARDS; ++i) {
+        struct shard *shard = &shards[i];
+        pthread_mutex_lock(&shard->lock);
+        arena_free(shard->arena);
+        free(shard->slots);
+        shard->arena = NULL;
+        shard->slots = NULL;
+        shard->capacity = shard->used = 0;
+        shard->stats = (struct intern_stats){0};
+        pthread_mutex_unlock(&shard->lock);
+    }
+}
@@ -0,0 +1,19 @@
+#pragma once
+
+#include <stddef.h>
+
+/* A process wide table of immutable strings. Interning the same
+ * contents twice returns the same pointer, so interned strings can be
+ * compared by address and must never be modified or freed. */
+char *intern(const char *str, size_t len);
+
+struct intern_stats {
+    size_t lookups;
+    size_t hits;
+    size_t strings;
+    size_t bytes;
+    size_t saved;
+};
+
+void intern_stats(struct intern_stats *stats);
+void intern_release(void);
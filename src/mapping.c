@@ -0,0 +1,38 @@
+#include "mapping.h"
+
+#include <errno.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+/* Map a whole regular file for a single sequential pass. Fails for
+ * anything that can't be mapped, like pipes or empty files, in which
+ * case callers should fall back to reading it. */
+int mapping_open(struct mapping *map, int fd)
+{
+    struct stat st;
+
+    *map = (struct mapping){0};
+    if (fstat(fd, &st) < 0)
+        return -1;
+
+    if (!S_ISREG(st.st_mode) || st.st_size == 0) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    void *data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (data == MAP_FAILED)
+        return -1;
+
+    madvise(data, st.st_size, MADV_SEQUENTIAL);
+
+    *map = (struct mapping){ .data = data, .len = st.st_size };
+    return 0;
+}
+
+void mapping_close(struct mapping *map)
+{
+    if (map->data)
+        munmap(map->data, map->len);
+    *map = (struct mapping){0};
+}
@@ -0,0 +1,16 @@
+#pragma once
+
+#include <stddef.h>
+
+/* libarchive's block size when a file can't be mapped */
+#ifndef READ_BLOCK_SIZE
+#define READ_BLOCK_SIZE 0x100000
+#endif
+
+struct mapping {
+    void *data;
+    size_t len;
+};
+
+int mapping_open(struct mapping *map, int fd);
+void mapping_close(struct mapping *map);
@@ -3,6 +3,7 @@
 #include <stdlib.h>
 #include <stdbool.h>
 #include <string.h>
+#include <errno.h>
 #include <err.h>
 #include <archive.h>
 #include <archive_entry.h>
@@ -12,48 +13,237 @@
 
 #include "util.h"
 #include "pkginfo.h"
-#include "pkghash.h"
 #include "base64.h"
+#include "checksum.h"
+#include "arena.h"
+#include "filelist.h"
+#include "intern.h"
+#include "mapping.h"
+#include "ingest.h"
+
+static char *rsplit(char *str, char *end)
+{
+    char *sep = memrchr(str, '-', end - str);
+    if (!sep || sep == str || sep + 1 == end)
+        return NULL;
+    *sep = '\0';
+    return sep + 1;
+}
+
+int parse_package_filename(const char *filename, struct pkgfile *pkgfile)
+{
+    const char *ext = strstr(filename, ".pkg.tar");
+    if (!ext || ext == filename)
+        goto invalid;
+
+    /* Accept a bare .pkg.tar or a single compression suffix, but
+     * never the detached signature. */
+    const char *suffix = ext + strlen(".pkg.tar");
+    if (*suffix && (*suffix != '.' || !suffix[1] || strchr(suffix + 1, '.') ||
+                    streq(suffix, ".sig")))
+        goto invalid;
+
+    char *name = strndup(filename, ext - filename);
+    check_null(name, "failed to allocate package filename");
+    char *end = name + (ext - filename);
+
+    char *arch = rsplit(name, end);
+    char *pkgrel = arch ? rsplit(name, arch - 1) : NULL;
+    char *pkgver = pkgrel ? rsplit(name, pkgrel - 1) : NULL;
+    if (!pkgver) {
+        free(name);
+        goto invalid;
+    }
+
+    /* Rejoin pkgver-pkgrel into a single version string */
+    pkgrel[-1] = '-';
+
+    *pkgfile = (struct pkgfile){
+        .name = name,
+        .version = pkgver,
+        .arch = arch
+    };
+    return 0;
+
+invalid:
+    errno = EINVAL;
+    return -1;
+}
+
+/* Packages are mapped when possible and handed to libarchive a slice
+ * at a time without copying. Otherwise they're read in large blocks. */
+struct pkgreader {
+    int fd;
+    struct checksum *checksum;
+    struct mapping map;
+    size_t pos;
+    char *buf;
+};
+
+static void pkgreader_init(struct pkgreader *reader, int fd, bool checksum)
+{
+    *reader = (struct pkgreader){
+        .fd = fd,
+        .checksum = checksum ? checksum_new() : NULL
+    };
+
+    if (mapping_open(&reader->map, fd) < 0) {
+        reader->buf = malloc(READ_BLOCK_SIZE);
+        check_null(reader->buf, "failed to allocate package reader");
+    }
+}
+
+static void pkgreader_close(struct pkgreader *reader)
+{
+    if (reader->checksum)
+        free(checksum_final(reader->checksum));
+    mapping_close(&reader->map);
+    free(reader->buf);
+}
 
-int load_package(pkg_t *pkg, int fd)
+static ssize_t pkgreader_next(struct pkgreader *reader, const void **buf)
+{
+    if (reader->map.data) {
+        size_t len = reader->map.len - reader->pos;
+        if (len > READ_BLOCK_SIZE)
+            len = READ_BLOCK_SIZE;
+
+        *buf = (const char *)reader->map.data + reader->pos;
+        reader->pos += len;
+        return len;
+    }
+
+    *buf = reader->buf;
+    return read(reader->fd, reader->buf, READ_BLOCK_SIZE);
+}
+
+static ssize_t pkgreader_read(struct archive *archive, void *data, const void **buf)
+{
+    struct pkgreader *reader = data;
+
+    ssize_t nbytes_r = pkgreader_next(reader, buf);
+    if (nbytes_r < 0) {
+        archive_set_error(archive, errno, "failed to read package");
+        return -1;
+    }
+
+    if (reader->checksum)
+        checksum_update(reader->checksum, *buf, nbytes_r);
+
+    return nbytes_r;
+}
+
+/* libarchive stops pulling data once it has seen the end of the
+ * archive, so feed whatever is left over into the checksum */
+static int pkgreader_finish(struct pkgreader *reader, struct pkg *pkg)
+{
+    for (;;) {
+        const void *buf;
+        ssize_t nbytes_r = pkgreader_next(reader, &buf);
+        if (nbytes_r < 0)
+            return -1;
+        if (nbytes_r == 0)
+            break;
+        checksum_update(reader->checksum, buf, nbytes_r);
+    }
+
+    _cleanup_free_ char *sha256sum = checksum_final(reader->checksum);
+    package_set(pkg, PKG_SHA256SUM, sha256sum, strlen(sha256sum));
+    reader->checksum = NULL;
+    return 0;
+}
+
+struct pkg *package_new(struct arena *arena)
+{
+    struct pkg *pkg = arena ? arena_alloc(arena, sizeof(struct pkg))
+                            : malloc(sizeof(struct pkg));
+    check_null(pkg, "failed to allocate package");
+
+    *pkg = (struct pkg){ .arena = arena };
+    return pkg;
+}
+
+/* Read whatever the flags ask for out of a package in a single pass
+ * over the file: the .PKGINFO metadata, the file list, and the
+ * checksum of the compressed package itself. When only the .PKGINFO is
+ * needed, stop reading as soon as it has been found. */
+static int read_package(pkg_t *pkg, int fd, int flags)
 {
     struct archive *archive;
     struct stat st;
+    int ret = 0;
 
     check_posix(fstat(fd, &st), "failed to stat file");
 
+    /* Declared first so it's cleaned up last, after the reader has
+     * unmapped the file */
+    const bool full_pass = flags & (PKG_LOAD_FILES | PKG_LOAD_SHA256);
+    _cleanup_(ingest_end) struct ingest ingest;
+    ingest_begin(&ingest, fd, full_pass);
+
+    _cleanup_(pkgreader_close) struct pkgreader reader;
+    pkgreader_init(&reader, fd, flags & PKG_LOAD_SHA256);
+
     archive = archive_read_new();
     archive_read_support_filter_all(archive);
     archive_read_support_format_all(archive);
 
-    if (archive_read_open_fd(archive, fd, 8192) != ARCHIVE_OK) {
+    if (archive_read_open(archive, &reader, NULL, pkgreader_read, NULL) != ARCHIVE_OK) {
         archive_read_free(archive);
         return -1;
     }
 
     bool found_pkginfo = false;
     struct archive_entry *entry;
-    while (archive_read_next_header(archive, &entry) == ARCHIVE_OK && !found_pkginfo) {
+    while (archive_read_next_header(archive, &entry) == ARCHIVE_OK) {
         const char *entry_name = archive_entry_pathname(entry);
         const mode_t mode = archive_entry_mode(entry);
 
-        if (S_ISREG(mode) && streq(entry_name, ".PKGINFO")) {
-            read_pkginfo(archive, pkg);
-            found_pkginfo = true;
+        if (entry_name[0] == '.') {
+            if ((flags & PKG_LOAD_PKGINFO) && S_ISREG(mode) && streq(entry_name, ".PKGINFO")) {
+                read_pkginfo(archive, pkg);
+                found_pkginfo = true;
+                if (!full_pass)
+                    break;
+            }
+        } else if (flags & PKG_LOAD_FILES) {
+            package_set(pkg, PKG_FILES, entry_name, strlen(entry_name));
         }
     }
 
     archive_read_close(archive);
     archive_read_free(archive);
 
-    if (found_pkginfo) {
+    if (reader.checksum && pkgreader_finish(&reader, pkg) < 0)
+        ret = -1;
+
+    if (flags & PKG_LOAD_PKGINFO) {
+        if (!found_pkginfo)
+            return -1;
+
         pkg->size = st.st_size;
-        pkg->mtime = st.st_mtime;
-        pkg->name_hash = _alpm_hash_sdbm(pkg->name);
-        return 0;
+        if (st.st_mtime > pkg->mtime)
+            pkg->mtime = st.st_mtime;
     }
 
-    return -1;
+    return ret;
+}
+
+/* Loading runs on many packages at once. Rather than have every worker
+ * contend on the shared arena for each string, fill a private one and
+ * hand it over in one go at the end. */
+int load_package(pkg_t *pkg, int fd, int flags)
+{
+    struct arena *owner = pkg->arena;
+    if (!owner)
+        return read_package(pkg, fd, flags);
+
+    pkg->arena = arena_new();
+    int ret = read_package(pkg, fd, flags);
+    arena_splice(owner, pkg->arena);
+    arena_free(pkg->arena);
+    pkg->arena = owner;
+    return ret;
 }
 
 int load_package_signature(struct pkg *pkg, int dirfd)
@@ -69,9 +259,10 @@ int load_package_signature(struct pkg *pkg, int dirfd)
     _cleanup_free_ char *signature = malloc(st.st_size);
     check_posix(read(fd, signature, st.st_size), "failed to read signature");
 
-    pkg->base64sig = base64_encode((const unsigned char *)signature,
-                                   st.st_size, NULL);
-    check_null(pkg->base64sig, "failed to find base64 signature");
+    _cleanup_free_ char *base64sig = base64_encode((const unsigned char *)signature,
+                                                   st.st_size, NULL);
+    check_null(base64sig, "failed to find base64 signature");
+    package_set(pkg, PKG_PGPSIG, base64sig, strlen(base64sig));
 
     // If the signature's timestamp is new than the packages, update
     // it to the newer value.
@@ -81,118 +272,140 @@ int load_package_signature(struct pkg *pkg, int dirfd)
     return 0;
 }
 
-int load_package_files(struct pkg *pkg, int fd)
+void package_free(pkg_t *pkg)
 {
-    struct archive *archive;
-    struct stat st;
-
-    check_posix(fstat(fd, &st), "failed to stat file");
-
-    archive = archive_read_new();
-    archive_read_support_filter_all(archive);
-    archive_read_support_format_all(archive);
-
-    if (archive_read_open_fd(archive, fd, 8192) != ARCHIVE_OK) {
-        archive_read_free(archive);
-        return -1;
-    }
-
-    struct archive_entry *entry;
-    while (archive_read_next_header(archive, &entry) == ARCHIVE_OK) {
-        const char *entry_name = archive_entry_pathname(entry);
-
-        if (entry_name[0] != '.')
-            pkg->files = alpm_list_add(pkg->files, strdup(entry_name));
-    }
+    filelist_free(pkg->files);
+    pkg->files = NULL;
 
-    archive_read_close(archive);
-    archive_read_free(archive);
-    return 0;
-}
+    /* Everything else in arena backed packages goes away with the
+     * arena */
+    if (pkg->arena)
+        return;
 
-void package_free(pkg_t *pkg)
-{
     free(pkg->filename);
     free(pkg->name);
     free(pkg->version);
     free(pkg->desc);
-    free(pkg->url);
-    free(pkg->packager);
     free(pkg->sha256sum);
     free(pkg->base64sig);
-    free(pkg->arch);
 
-    alpm_list_free_inner(pkg->groups, free);
+    /* Interned strings are shared, only the list nodes belong to us */
     alpm_list_free(pkg->groups);
-    alpm_list_free_inner(pkg->licenses, free);
     alpm_list_free(pkg->licenses);
-    alpm_list_free_inner(pkg->depends, free);
     alpm_list_free(pkg->depends);
-    alpm_list_free_inner(pkg->conflicts, free);
     alpm_list_free(pkg->conflicts);
-    alpm_list_free_inner(pkg->provides, free);
     alpm_list_free(pkg->provides);
-    alpm_list_free_inner(pkg->optdepends, free);
     alpm_list_free(pkg->optdepends);
-    alpm_list_free_inner(pkg->makedepends, free);
     alpm_list_free(pkg->makedepends);
-    alpm_list_free_inner(pkg->files, free);
-    alpm_list_free(pkg->files);
+    alpm_list_free(pkg->checkdepends);
+    alpm_list_free(pkg->replaces);
 
     free(pkg);
 }
 
-static void pkg_append_list(const char *entry, size_t len, alpm_list_t **list)
+/* Same layout alpm_list_add produces: the head's prev points at the
+ * tail, the tail's next is NULL */
+static alpm_list_t *arena_list_add(struct arena *arena, alpm_list_t *list, void *data)
+{
+    alpm_list_t *node = arena_alloc(arena, sizeof(alpm_list_t));
+    node->data = data;
+    node->next = NULL;
+
+    if (!list) {
+        node->prev = node;
+        return node;
+    }
+
+    node->prev = list->prev;
+    list->prev->next = node;
+    list->prev = node;
+    return list;
+}
+
+/* List entries are dependencies, licenses and groups, which repeat
+ * across packages far more often than not */
+static void pkg_append_list(pkg_t *pkg, const char *entry, size_t len, alpm_list_t **list)
 {
-    *list = alpm_list_add(*list, strndup(entry, len));
+    if (pkg->arena)
+        *list = arena_list_add(pkg->arena, *list, intern(entry, len));
+    else
+        *list = alpm_list_add(*list, intern(entry, len));
 }
 
-static void pkg_set_string(const char *entry, size_t len, char **data)
+static void pkg_set_interned(const char *entry, size_t len, char **data)
 {
-    free(*data);
-    *data = strndup(entry, len);
+    *data = intern(entry, len);
+}
+
+static void pkg_set_string(pkg_t *pkg, const char *entry, size_t len, char **data)
+{
+    if (pkg->arena) {
+        *data = arena_strndup(pkg->arena, entry, len);
+    } else {
+        free(*data);
+        *data = strndup(entry, len);
+    }
+}
+
+/* Entries are spans into the parser's input and aren't terminated, so
+ * numbers are parsed from a bounded copy */
+static bool copy_number(const char *entry, size_t len, char *out, size_t out_len)
+{
+    if (len >= out_len)
+        return false;
+
+    memcpy(out, entry, len);
+    out[len] = '\0';
+    return true;
 }
 
 static void pkg_set_size(const char *entry, size_t len, size_t *data)
 {
-    (void)len;
-    parse_size(entry, data);
+    char value[32];
+    if (copy_number(entry, len, value, sizeof(value)))
+        parse_size(value, data);
 }
 
 static void pkg_set_time(const char *entry, size_t len, time_t *data)
 {
-    (void)len;
-    parse_time(entry, data);
+    char value[32];
+    if (copy_number(entry, len, value, sizeof(value)))
+        parse_time(value, data);
+}
+
+static inline bool span_eq(const char *entry, size_t len, const char *str)
+{
+    return strlen(str) == len && memcmp(entry, str, len) == 0;
 }
 
 void package_set(pkg_t *pkg, enum pkg_entry type, const char *entry, size_t len)
 {
     switch (type) {
     case PKG_FILENAME:
-        pkg_set_string(entry, len, &pkg->filename);
+        pkg_set_string(pkg, entry, len, &pkg->filename);
         break;
     case PKG_PKGNAME:
         if (!pkg->name) {
-            pkg_set_string(entry, len, &pkg->name);
-        } else if (!strneq(entry, pkg->name, len)) {
+            pkg_set_string(pkg, entry, len, &pkg->name);
+        } else if (!span_eq(entry, len, pkg->name)) {
             errx(EXIT_FAILURE, "database entry %%NAME%% and desc record are mismatched!");
         }
         break;
     case PKG_PKGBASE:
-        pkg_set_string(entry, len, &pkg->base);
+        pkg_set_interned(entry, len, &pkg->base);
         break;
     case PKG_VERSION:
         if (!pkg->version) {
-            pkg_set_string(entry, len, &pkg->version);
-        } else if (!strneq(entry, pkg->version, len)) {
+            pkg_set_string(pkg, entry, len, &pkg->version);
+        } else if (!span_eq(entry, len, pkg->version)) {
             errx(EXIT_FAILURE, "database entry %%VERSION%% and desc record are mismatched!");
         }
         break;
     case PKG_DESCRIPTION:
-        pkg_set_string(entry, len, &pkg->desc);
+        pkg_set_string(pkg, entry, len, &pkg->desc);
         break;
     case PKG_GROUPS:
-        pkg_append_list(entry, len, &pkg->groups);
+        pkg_append_list(pkg, entry, len, &pkg->groups);
         break;
     case PKG_CSIZE:
         pkg_set_size(entry, len, &pkg->size);
@@ -201,49 +414,51 @@ void package_set(pkg_t *pkg, enum pkg_entry type, const char *entry, size_t len)
         pkg_set_size(entry, len, &pkg->isize);
         break;
     case PKG_SHA256SUM:
-        pkg_set_string(entry, len, &pkg->sha256sum);
+        pkg_set_string(pkg, entry, len, &pkg->sha256sum);
         break;
     case PKG_PGPSIG:
-        pkg_set_string(entry, len, &pkg->base64sig);
+        pkg_set_string(pkg, entry, len, &pkg->base64sig);
         break;
     case PKG_URL:
-        pkg_set_string(entry, len, &pkg->url);
+        pkg_set_interned(entry, len, &pkg->url);
         break;
     case PKG_LICENSE:
-        pkg_append_list(entry, len, &pkg->licenses);
+        pkg_append_list(pkg, entry, len, &pkg->licenses);
         break;
     case PKG_ARCH:
-        pkg_set_string(entry, len, &pkg->arch);
+        pkg_set_interned(entry, len, &pkg->arch);
         break;
     case PKG_BUILDDATE:
         pkg_set_time(entry, len, &pkg->builddate);
         break;
     case PKG_PACKAGER:
-        pkg_set_string(entry, len, &pkg->packager);
+        pkg_set_interned(entry, len, &pkg->packager);
         break;
     case PKG_REPLACES:
-        pkg_append_list(entry, len, &pkg->replaces);
+        pkg_append_list(pkg, entry, len, &pkg->replaces);
         break;
     case PKG_DEPENDS:
-        pkg_append_list(entry, len, &pkg->depends);
+        pkg_append_list(pkg, entry, len, &pkg->depends);
         break;
     case PKG_CONFLICTS:
-        pkg_append_list(entry, len, &pkg->conflicts);
+        pkg_append_list(pkg, entry, len, &pkg->conflicts);
         break;
     case PKG_PROVIDES:
-        pkg_append_list(entry, len, &pkg->provides);
+        pkg_append_list(pkg, entry, len, &pkg->provides);
         break;
     case PKG_OPTDEPENDS:
-        pkg_append_list(entry, len, &pkg->optdepends);
+        pkg_append_list(pkg, entry, len, &pkg->optdepends);
         break;
     case PKG_MAKEDEPENDS:
-        pkg_append_list(entry, len, &pkg->makedepends);
+        pkg_append_list(pkg, entry, len, &pkg->makedepends);
         break;
     case PKG_CHECKDEPENDS:
-        pkg_append_list(entry, len, &pkg->checkdepends);
+        pkg_append_list(pkg, entry, len, &pkg->checkdepends);
         break;
     case PKG_FILES:
-        pkg_append_list(entry, len, &pkg->files);
+        if (!pkg->files)
+            pkg->files = filelist_new();
+        filelist_add(pkg->files, entry, len);
         break;
     default:
         errx(EXIT_FAILURE, "parse failure");
@@ -1,9 +1,14 @@
 #pragma once
 
 #include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
 #include <time.h>
 #include <alpm_list.h>
 
+struct arena;
+struct filelist;
+
 enum pkg_entry {
     PKG_FILENAME,
     PKG_PKGNAME,
@@ -31,7 +36,7 @@ enum pkg_entry {
 };
 
 typedef struct pkg {
-    unsigned long name_hash;
+    uint64_t name_hash;
     char *filename;
     char *name;
     char *base;
@@ -56,11 +61,43 @@ typedef struct pkg {
     alpm_list_t *optdepends;
     alpm_list_t *makedepends;
     alpm_list_t *checkdepends;
-    alpm_list_t *files;
+    struct filelist *files;
+
+    /* Where each of this package's entries sits in the database it
+     * was loaded from. Entries flagged in verbatim (a mask of enum
+     * contents) are unchanged since we wrote them and can be copied
+     * back out as is; seen masks the entries found in any database so
+     * far. files_pending means the file list hasn't been read yet. */
+    int64_t desc_offset;
+    int64_t depends_offset;
+    int64_t files_offset;
+    unsigned int verbatim;
+    unsigned int seen;
+    bool files_pending;
+
+    /* When set, all of the above but the file list is allocated from
+     * here */
+    struct arena *arena;
 } pkg_t;
 
-int load_package(pkg_t *pkg, int fd);
+/* The components of a name-pkgver-pkgrel-arch.pkg.tar.* filename. All
+ * fields point into a single allocation owned by name. */
+struct pkgfile {
+    char *name;
+    char *version;
+    char *arch;
+};
+
+int parse_package_filename(const char *filename, struct pkgfile *pkgfile);
+
+enum pkg_load {
+    PKG_LOAD_PKGINFO = 1,
+    PKG_LOAD_FILES   = 1 << 1,
+    PKG_LOAD_SHA256  = 1 << 2
+};
+
+struct pkg *package_new(struct arena *arena);
+int load_package(pkg_t *pkg, int fd, int flags);
 int load_package_signature(struct pkg *pkg, int fd);
-int load_package_files(pkg_t *pkg, int fd);
 void package_free(pkg_t *pkg);
 void package_set(pkg_t *pkg, enum pkg_entry type, const char *entry, size_t len);
@@ -0,0 +1,295 @@
+#include "pkgcache.h"
+
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <sys/types.h>
+#ifdef __SSE2__
+  #include <emmintrin.h>
+#endif
+
+#include "util.h"
+
+#define GROUP_WIDTH 16
+
+/* Control bytes: empty and deleted slots have the top bit set, while
+ * occupied slots hold the low 7 bits of the hash */
+#define CTRL_EMPTY   ((int8_t)-128)
+#define CTRL_DELETED ((int8_t)-2)
+
+static inline uint64_t fmix64(uint64_t k)
+{
+    k ^= k >> 33;
+    k *= 0xff51afd7ed558ccdULL;
+    k ^= k >> 33;
+    k *= 0xc4ceb9fe1a85ec53ULL;
+    k ^= k >> 33;
+    return k;
+}
+
+/* FNV-1a, with a final avalanche so both the low bits (the tag) and the
+ * high bits (the position) are well distributed */
+uint64_t pkgcache_hash(const char *name)
+{
+    uint64_t hash = 0xcbf29ce484222325ULL;
+    for (const unsigned char *c = (const unsigned char *)name; *c; ++c) {
+        hash ^= *c;
+        hash *= 0x100000001b3ULL;
+    }
+    return fmix64(hash);
+}
+
+static inline int8_t hash_tag(uint64_t hash)
+{
+    return hash & 0x7f;
+}
+
+static inline size_t hash_group(uint64_t hash, size_t groups)
+{
+    return (hash >> 7) & (groups - 1);
+}
+
+#ifdef __SSE2__
+static inline uint32_t group_match(const int8_t *group, int8_t tag)
+{
+    const __m128i ctrl = _mm_loadu_si128((const __m128i *)group);
+    return _mm_movemask_epi8(_mm_cmpeq_epi8(ctrl, _mm_set1_epi8(tag)));
+}
+
+static inline uint32_t group_match_free(const int8_t *group)
+{
+    const __m128i ctrl = _mm_loadu_si128((const __m128i *)group);
+    return _mm_movemask_epi8(ctrl);
+}
+#else
+static inline uint32_t group_match(const int8_t *group, int8_t tag)
+{
+    uint32_t mask = 0;
+    for (int i = 0; i < GROUP_WIDTH; ++i) {
+        if (group[i] == tag)
+            mask |= 1u << i;
+    }
+    return mask;
+}
+
+static inline uint32_t group_match_free(const int8_t *group)
+{
+    uint32_t mask = 0;
+    for (int i = 0; i < GROUP_WIDTH; ++i) {
+        if (group[i] < 0)
+            mask |= 1u << i;
+    }
+    return mask;
+}
+#endif
+
+static size_t capacity_for(size_t size)
+{
+    /* Keep the table at most 7/8ths full */
+    size_t want = size + size / 7 + 1, capacity = GROUP_WIDTH;
+    while (capacity < want)
+        capacity <<= 1;
+    return capacity;
+}
+
+static void table_init(struct pkgcache *cache, size_t capacity)
+{
+    cache->ctrl = malloc(capacity);
+    cache->slots = malloc(capacity * sizeof(uint32_t));
+    check_null(cache->ctrl, "failed to allocate package cache");
+    check_null(cache->slots, "failed to allocate package cache");
+
+    memset(cache->ctrl, CTRL_EMPTY, capacity);
+    cache->capacity = capacity;
+    cache->used = 0;
+}
+
+static void table_insert(struct pkgcache *cache, uint64_t hash, uint32_t idx)
+{
+    const size_t groups = cache->capacity / GROUP_WIDTH;
+    size_t group = hash_group(hash, groups);
+
+    /* Triangular probing visits every group when the count is a
+     * power of two, and the load factor guarantees a free slot */
+    for (size_t step = 1;; ++step) {
+        const int8_t *ctrl = &cache->ctrl[group * GROUP_WIDTH];
+        uint32_t mask = group_match_free(ctrl);
+        if (mask) {
+            size_t slot = group * GROUP_WIDTH + __builtin_ctz(mask);
+            if (cache->ctrl[slot] == CTRL_EMPTY)
+                ++cache->used;
+            cache->ctrl[slot] = hash_tag(hash);
+            cache->slots[slot] = idx;
+            return;
+        }
+        group = (group + step) & (groups - 1);
+    }
+}
+
+static ssize_t table_find(const struct pkgcache *cache, uint64_t hash, const char *name)
+{
+    const size_t groups = cache->capacity / GROUP_WIDTH;
+    const int8_t tag = hash_tag(hash);
+    size_t group = hash_group(hash, groups);
+
+    for (size_t step = 1; step <= groups; ++step) {
+        const int8_t *ctrl = &cache->ctrl[group * GROUP_WIDTH];
+
+        for (uint32_t mask = group_match(ctrl, tag); mask; mask &= mask - 1) {
+            size_t slot = group * GROUP_WIDTH + __builtin_ctz(mask);
+            const struct pkg *pkg = cache->pkgs[cache->slots[slot]];
+            if (pkg->name_hash == hash && streq(pkg->name, name))
+                return slot;
+        }
+
+        if (group_match(ctrl, CTRL_EMPTY))
+            break;
+        group = (group + step) & (groups - 1);
+    }
+
+    return -1;
+}
+
+/* Squeeze the holes left by removals out of the package array */
+static void compact(struct pkgcache *cache)
+{
+    size_t count = 0;
+    for (size_t i = 0; i < cache->count; ++i) {
+        if (cache->pkgs[i])
+            cache->pkgs[count++] = cache->pkgs[i];
+    }
+    cache->count = count;
+}
+
+static void rebuild(struct pkgcache *cache)
+{
+    memset(cache->ctrl, CTRL_EMPTY, cache->capacity);
+    cache->used = 0;
+    for (size_t i = 0; i < cache->count; ++i)
+        table_insert(cache, cache->pkgs[i]->name_hash, i);
+}
+
+static void rehash(struct pkgcache *cache, size_t size)
+{
+    compact(cache);
+
+    free(cache->ctrl);
+    free(cache->slots);
+    table_init(cache, capacity_for(size));
+    rebuild(cache);
+}
+
+struct pkgcache *pkgcache_new(size_t size)
+{
+    struct pkgcache *cache = calloc(1, sizeof(struct pkgcache));
+    check_null(cache, "failed to allocate package cache");
+
+    table_init(cache, capacity_for(size));
+
+    cache->size = size ? size : 1;
+    cache->pkgs = malloc(cache->size * sizeof(struct pkg *));
+    check_null(cache->pkgs, "failed to allocate package cache");
+
+    return cache;
+}
+
+void pkgcache_free(struct pkgcache *cache)
+{
+    if (!cache)
+        return;
+
+    free(cache->ctrl);
+    free(cache->slots);
+    free(cache->pkgs);
+    free(cache);
+}
+
+struct pkg *pkgcache_find(const struct pkgcache *cache, const char *name)
+{
+    if (!cache || !name)
+        return NULL;
+
+    ssize_t slot = table_find(cache, pkgcache_hash(name), name);
+    return slot < 0 ? NULL : cache->pkgs[cache->slots[slot]];
+}
+
+void pkgcache_add(struct pkgcache *cache, struct pkg *pkg)
+{
+    pkg->name_hash = pkgcache_hash(pkg->name);
+
+    if (cache->count == cache->size) {
+        /* Reclaim holes left by removals before growing */
+        if (cache->entries < cache->count / 2) {
+            rehash(cache, cache->entries + 1);
+        } else {
+            cache->size *= 2;
+            cache->pkgs = realloc(cache->pkgs, cache->size * sizeof(struct pkg *));
+            check_null(cache->pkgs, "failed to allocate package cache");
+        }
+    }
+
+    if (cache->used + 1 > cache->capacity - cache->capacity / 8)
+        rehash(cache, cache->entries * 2 + 1);
+
+    cache->pkgs[cache->count] = pkg;
+    table_insert(cache, pkg->name_hash, cache->count);
+    cache->count += 1;
+    cache->entries += 1;
+}
+
+void pkgcache_replace(struct pkgcache *cache, struct pkg *new, struct pkg *old)
+{
+    ssize_t slot = table_find(cache, old->name_hash, old->name);
+    if (slot < 0 || !streq(new->name, old->name)) {
+        pkgcache_remove(cache, old);
+        pkgcache_add(cache, new);
+        return;
+    }
+
+    /* Same name, same slot: swap the package in place so it also keeps
+     * its position in the iteration order */
+    new->name_hash = old->name_hash;
+    cache->pkgs[cache->slots[slot]] = new;
+}
+
+void pkgcache_remove(struct pkgcache *cache, struct pkg *pkg)
+{
+    if (!cache || !pkg)
+        return;
+
+    ssize_t slot = table_find(cache, pkg->name_hash, pkg->name);
+    if (slot < 0)
+        return;
+
+    cache->pkgs[cache->slots[slot]] = NULL;
+    cache->ctrl[slot] = CTRL_DELETED;
+    cache->entries -= 1;
+}
+
+static int pkg_cmp(const void *p1, const void *p2)
+{
+    const struct pkg *pkg1 = *(struct pkg *const *)p1;
+    const struct pkg *pkg2 = *(struct pkg *const *)p2;
+    return strcmp(pkg1->name, pkg2->name);
+}
+
+/* Sort the iteration order by name. Input that's already in order, as
+ * databases usually are, is detected in a single pass. */
+void pkgcache_sort(struct pkgcache *cache)
+{
+    const struct pkg *prev = NULL;
+    bool sorted = cache->entries == cache->count;
+
+    for (size_t i = 0; sorted && i < cache->count; ++i) {
+        if (prev && strcmp(prev->name, cache->pkgs[i]->name) > 0)
+            sorted = false;
+        prev = cache->pkgs[i];
+    }
+
+    if (sorted)
+        return;
+
+    compact(cache);
+    qsort(cache->pkgs, cache->count, sizeof(struct pkg *), pkg_cmp);
+    rebuild(cache);
+}
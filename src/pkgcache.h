@@ -0,0 +1,40 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include "package.h"
+
+/* An open addressing hash table of packages keyed by name. Slots are
+ * tracked by a byte of control data each, holding 7 bits of the hash
+ * for occupied slots, and probed a group of 16 at a time. Packages
+ * themselves live in a separate array which keeps insertion order for
+ * iteration; removals leave a hole which is skipped. */
+struct pkgcache {
+    int8_t *ctrl;
+    uint32_t *slots;
+    size_t capacity;
+    size_t used;
+
+    struct pkg **pkgs;
+    size_t count;
+    size_t size;
+
+    size_t entries;
+};
+
+uint64_t pkgcache_hash(const char *name);
+
+struct pkgcache *pkgcache_new(size_t size);
+void pkgcache_free(struct pkgcache *cache);
+
+struct pkg *pkgcache_find(const struct pkgcache *cache, const char *name);
+void pkgcache_add(struct pkgcache *cache, struct pkg *pkg);
+void pkgcache_replace(struct pkgcache *cache, struct pkg *new, struct pkg *old);
+void pkgcache_remove(struct pkgcache *cache, struct pkg *pkg);
+void pkgcache_sort(struct pkgcache *cache);
+
+/* Iterate over the packages in order. It's safe to remove the current
+ * package from inside the loop. */
+#define pkgcache_foreach(cache, pkg) \
+    for (size_t _idx = 0; _idx < (cache)->count; ++_idx) \
+        if (((pkg) = (cache)->pkgs[_idx]) == NULL) {} else
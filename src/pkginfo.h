@@ -2,19 +2,22 @@
 
 #include <stddef.h>
 #include <sys/types.h>
-#include <limits.h>
+#include <stdbool.h>
 #include "package.h"
+#include "buffer.h"
 
 struct archive;
 
 struct pkginfo_parser {
     int cs;
     enum pkg_entry entry;
-    size_t pos;
-    char store[LINE_MAX];
+    const char *mark;
+    bool partial;
+    struct buffer spill;
 };
 
 void pkginfo_parser_init(struct pkginfo_parser *parser);
+void pkginfo_parser_release(struct pkginfo_parser *parser);
 ssize_t pkginfo_parser_feed(struct pkginfo_parser *parser, struct pkg *pkg,
                             char *buf, size_t buf_len);
 void read_pkginfo(struct archive *archive, struct pkg *pkg);
@@ -16,19 +16,20 @@
 #include <alpm_list.h>
 #include <sys/utsname.h>
 #include <sys/stat.h>
-#include <sys/ioctl.h>
-#ifdef __linux__
-  #include <linux/btrfs.h>
-#endif
 #include <locale.h>
 
 #include "database.h"
 #include "filecache.h"
+#include "scancache.h"
 #include "package.h"
-#include "pkghash.h"
+#include "pkgcache.h"
+#include "intern.h"
 #include "filters.h"
+#include "fsops.h"
+#include "ingest.h"
 #include "signing.h"
 #include "base64.h"
+#include "worker.h"
 #include "util.h"
 
 struct config config = {0};
@@ -64,7 +65,18 @@ static _noreturn_ void usage(FILE *out, const char* program_invocation_short_nam
           " -J, --xz              filter the archive through xz\n"
           " -z, --gzip            filter the archive through gzip\n"
           " -Z, --compress        filter the archive through compress\n"
+          "     --zstd            filter the archive through zstd\n"
+          "     --lz4             filter the archive through lz4\n"
+          "     --compression-level=N\n"
+          "                       compression level to pass to the filter\n"
+          "     --zstd-long[=N]   zstd long distance matching, with a 2^N window\n"
+          "     --jobs=N          number of packages to scan in parallel\n"
+          "     --threads=N       number of threads compressing the database\n"
           "     --reflink         make repose make reflinks instead of symlinks\n"
+          "     --hardlink        make repose make hardlinks instead of symlinks\n"
+          "     --noatime         don't update access times of packages read\n"
+          "     --max-inflight=MIB\n"
+          "                       cap on package data being read at once\n"
           "     --rebuild         force rebuild the repo\n", out);
 
     exit(out == stderr ? EXIT_FAILURE : EXIT_SUCCESS);
@@ -111,10 +123,12 @@ static int clone_file(const struct repo *repo, const char *filename)
     if (src < 0)
 	return src;
 
-    _cleanup_close_ int dest = openat(repo->rootfd, filename, O_WRONLY | O_TRUNC, 0664);
-    if (dest < 0 && errno == ENOENT) {
-        dest = openat(repo->rootfd, filename, O_WRONLY | O_CREAT, 0664);
-    }
+    /* Whatever is in the way may be a symlink or hardlink to the very
+     * file being cloned, so replace it rather than write through it */
+    if (unlinkat(repo->rootfd, filename, 0) < 0 && errno != ENOENT)
+        return -1;
+
+    _cleanup_close_ int dest = openat(repo->rootfd, filename, O_WRONLY | O_CREAT | O_EXCL, 0664);
     if (dest < 0)
 	return dest;
 
@@ -123,19 +137,59 @@ static int clone_file(const struct repo *repo, const char *filename)
 
 static int symlink_file(const struct repo *repo, const char *path1, const char *path2)
 {
-    _cleanup_free_ char* canonical_path1 = canonicalize_file_name(path1);
-    int ret = symlinkat(canonical_path1, repo->rootfd, path2);
+    int ret = symlinkat(path1, repo->rootfd, path2);
     if (ret < 0 && errno == EEXIST)
         return 0;
     return ret;
 }
 
+/* Hardlink where the pool and the root share a filesystem, otherwise
+ * fall back to cloning. Protected hardlinks and link count limits can
+ * refuse a link just as well, and cloning is the answer there too. */
+static int hardlink_file(const struct repo *repo, const char *filename)
+{
+    if (linkat(repo->poolfd, filename, repo->rootfd, filename, 0) == 0)
+        return 0;
+
+    switch (errno) {
+    case EEXIST: {
+        struct stat src, dest;
+        if (fstatat(repo->poolfd, filename, &src, 0) < 0 ||
+            fstatat(repo->rootfd, filename, &dest, AT_SYMLINK_NOFOLLOW) < 0)
+            return -1;
+        if (src.st_dev == dest.st_dev && src.st_ino == dest.st_ino)
+            return 0;
+
+        if (unlinkat(repo->rootfd, filename, 0) < 0)
+            return -1;
+        return hardlink_file(repo, filename);
+    }
+    case EXDEV:
+    case EPERM:
+    case EMLINK:
+        return clone_file(repo, filename);
+    default:
+        return -1;
+    }
+}
+
+static inline bool is_link(const struct repo *repo, const struct stat *st)
+{
+    if (S_ISLNK(st->st_mode))
+        return true;
+
+    /* With a pool of its own, the only regular files of a package's
+     * name in the root are the links --hardlink made, or the copies it
+     * fell back to */
+    return config.hardlink && repo->pool && S_ISREG(st->st_mode);
+}
+
 static inline int unlink_file(const struct repo *repo, const char *filename)
 {
     struct stat st;
     if (fstatat(repo->rootfd, filename, &st, AT_SYMLINK_NOFOLLOW) < 0)
         return errno != ENOENT ? -1 : 0;
-    if (S_ISLNK(st.st_mode))
+    if (is_link(repo, &st))
         return unlinkat(repo->rootfd, filename, 0);
     return 0;
 }
@@ -149,13 +203,22 @@ static int clone_pkg(const struct repo *repo, const struct pkg *pkg)
     return clone_file(repo, pkg->filename);
 }
 
+static int hardlink_pkg(const struct repo *repo, const struct pkg *pkg)
+{
+    _cleanup_free_ char *signame = joinstring(pkg->filename, ".sig", NULL);
+    if (hardlink_file(repo, signame) < 0 && errno != ENOENT)
+	err(1, "failed to hardlink signature %s", signame);
+
+    return hardlink_file(repo, pkg->filename);
+}
+
 static int symlink_pkg(const struct repo *repo, const struct pkg *pkg)
 {
-    _cleanup_free_ char *link = joinstring(repo->pool, "/", pkg->filename, NULL);
-    _cleanup_free_ char *siglink = joinstring(link, ".sig", NULL);
+    _cleanup_free_ char *link = joinstring(repo->poolpath, "/", pkg->filename, NULL);
+    _cleanup_free_ char *signame = joinstring(pkg->filename, ".sig", NULL);
 
-    if (access(siglink, F_OK) != -1) {
-	_cleanup_free_ char *signame = joinstring(pkg->filename, ".sig", NULL);
+    if (faccessat(repo->poolfd, signame, F_OK, 0) != -1) {
+	_cleanup_free_ char *siglink = joinstring(link, ".sig", NULL);
 	if (symlink_file(repo, siglink, signame) < 0 && errno != EEXIST)
 	    err(1, "failed to symlink signature %s", signame);
     }
@@ -168,6 +231,9 @@ static inline void link_pkg(const struct repo *repo, const struct pkg *pkg)
     if (config.reflink) {
         check_posix(clone_pkg(repo, pkg),
                     "failed to make reflink for %s", pkg->filename);
+    } else if (config.hardlink) {
+        check_posix(hardlink_pkg(repo, pkg),
+                    "failed to make hardlink for %s", pkg->filename);
     } else {
         check_posix(symlink_pkg(repo, pkg),
                     "failed to make symlink for %s", pkg->filename);
@@ -184,14 +250,186 @@ static inline int unlink_pkg(const struct repo *repo, const struct pkg *pkg)
     return unlink_file(repo, signame);
 }
 
+/* unlink_pkg() for a whole set of packages at once, as one batch of
+ * stats followed by one batch of unlinks for whatever were links */
+static void unlink_pkgs(const struct repo *repo, struct pkg **pkgs, size_t count)
+{
+    const size_t nfiles = count * 2;
+    _cleanup_free_ char **signames = calloc(count + 1, sizeof(char *));
+    _cleanup_free_ struct stat *stats = calloc(nfiles + 1, sizeof(struct stat));
+    _cleanup_free_ struct fsop *ops = calloc(nfiles + 1, sizeof(struct fsop));
+    if (!signames || !stats || !ops)
+        err(EXIT_FAILURE, "failed to allocate unlink requests");
+
+    for (size_t i = 0; i < count; ++i) {
+        signames[i] = joinstring(pkgs[i]->filename, ".sig", NULL);
+        ops[2 * i] = (struct fsop){
+            .type = FSOP_STAT,
+            .dirfd = repo->rootfd,
+            .path = pkgs[i]->filename,
+            .flags = AT_SYMLINK_NOFOLLOW,
+            .st = &stats[2 * i]
+        };
+        ops[2 * i + 1] = (struct fsop){
+            .type = FSOP_STAT,
+            .dirfd = repo->rootfd,
+            .path = signames[i],
+            .flags = AT_SYMLINK_NOFOLLOW,
+            .st = &stats[2 * i + 1]
+        };
+    }
+
+    fsops_run(ops, nfiles);
+
+    size_t nlinks = 0;
+    for (size_t i = 0; i < nfiles; ++i) {
+        if (ops[i].result < 0 || !is_link(repo, &stats[i]))
+            continue;
+
+        ops[nlinks++] = (struct fsop){
+            .type = FSOP_UNLINK,
+            .dirfd = repo->rootfd,
+            .path = ops[i].path
+        };
+    }
+
+    fsops_run(ops, nlinks);
+
+    for (size_t i = 0; i < count; ++i)
+        free(signames[i]);
+}
+
+/* Make the symlinks or hardlinks for a set of packages in as few
+ * batches of filesystem operations as possible. Packages that need
+ * anything more than the plain link, or where it failed, are left at
+ * the front of pkgs for link_pkg() to redo one by one, which also
+ * reports any real errors. Returns how many were left. */
+static size_t link_batch(const struct repo *repo, struct pkg **pkgs, size_t count)
+{
+    const size_t nfiles = count * 2;
+    _cleanup_free_ char **names = calloc(nfiles + 1, sizeof(char *));
+    _cleanup_free_ char **targets = calloc(nfiles + 1, sizeof(char *));
+    _cleanup_free_ size_t *files = calloc(nfiles + 1, sizeof(size_t));
+    _cleanup_free_ bool *failed = calloc(count + 1, sizeof(bool));
+    _cleanup_free_ struct fsop *ops = calloc(nfiles + 1, sizeof(struct fsop));
+    if (!names || !targets || !files || !failed || !ops)
+        err(EXIT_FAILURE, "failed to allocate link requests");
+
+    for (size_t i = 0; i < count; ++i) {
+        names[2 * i] = pkgs[i]->filename;
+        names[2 * i + 1] = joinstring(pkgs[i]->filename, ".sig", NULL);
+    }
+
+    /* Symlinks would happily dangle, so first find out which
+     * signatures exist. A hardlink to a missing signature just fails
+     * with ENOENT, which is fine. */
+    if (!config.hardlink) {
+        for (size_t i = 0; i < count; ++i) {
+            ops[i] = (struct fsop){
+                .type = FSOP_STAT,
+                .dirfd = repo->poolfd,
+                .path = names[2 * i + 1]
+            };
+        }
+
+        fsops_run(ops, count);
+
+        for (size_t i = 0; i < count; ++i) {
+            if (ops[i].result == -ENOENT) {
+                free(names[2 * i + 1]);
+                names[2 * i + 1] = NULL;
+            } else if (ops[i].result < 0) {
+                failed[i] = true;
+            }
+        }
+    }
+
+    size_t nops = 0;
+    for (size_t i = 0; i < nfiles; ++i) {
+        if (!names[i] || failed[i / 2])
+            continue;
+
+        files[nops] = i;
+        if (config.hardlink) {
+            ops[nops++] = (struct fsop){
+                .type = FSOP_LINK,
+                .dirfd = repo->poolfd,
+                .path = names[i],
+                .newdirfd = repo->rootfd,
+                .newpath = names[i]
+            };
+        } else {
+            targets[i] = joinstring(repo->poolpath, "/", names[i], NULL);
+            ops[nops++] = (struct fsop){
+                .type = FSOP_SYMLINK,
+                .path = targets[i],
+                .newdirfd = repo->rootfd,
+                .newpath = names[i]
+            };
+        }
+    }
+
+    fsops_run(ops, nops);
+
+    for (size_t i = 0; i < nops; ++i) {
+        const int result = ops[i].result;
+        const bool is_sig = files[i] % 2;
+
+        if (result == 0)
+            continue;
+        if (!config.hardlink && result == -EEXIST)
+            continue;
+        if (config.hardlink && is_sig && result == -ENOENT)
+            continue;
+        failed[files[i] / 2] = true;
+    }
+
+    size_t left = 0;
+    for (size_t i = 0; i < count; ++i) {
+        if (failed[i])
+            pkgs[left++] = pkgs[i];
+        free(names[2 * i + 1]);
+        free(targets[2 * i]);
+        free(targets[2 * i + 1]);
+    }
+
+    return left;
+}
+
+struct link_job {
+    const struct repo *repo;
+    struct pkg **pkgs;
+};
+
+static void link_one(size_t idx, void *arg)
+{
+    struct link_job *job = arg;
+    link_pkg(job->repo, job->pkgs[idx]);
+}
+
+/* Packages that were already in the database were linked when they
+ * were added, so only the ones changed this run need linking. Plain
+ * links go out as a batch. Anything else is linked independently, and
+ * a reflink that has to fall back to copying is bound by I/O, so
+ * spread them over --jobs workers */
 static void link_db(struct repo *repo)
 {
-    if (!repo->pool)
+    if (!repo->pool || !repo->changed)
         return;
 
-    alpm_list_t *node;
-    for (node = repo->cache->list; node; node = node->next)
-        link_pkg(repo, node->data);
+    size_t count = alpm_list_count(repo->changed);
+    _cleanup_free_ struct pkg **pkgs = calloc(count, sizeof(struct pkg *));
+    check_null(pkgs, "failed to allocate package list");
+
+    size_t idx = 0;
+    for (alpm_list_t *node = repo->changed; node; node = node->next)
+        pkgs[idx++] = node->data;
+
+    if (!config.reflink)
+        count = link_batch(repo, pkgs, count);
+
+    struct link_job job = { .repo = repo, .pkgs = pkgs };
+    parallel_for(count, config.jobs, link_one, &job);
 }
 
 static void drop_from_repo(struct repo *repo, alpm_list_t *targets)
@@ -199,29 +437,31 @@ static void drop_from_repo(struct repo *repo, alpm_list_t *targets)
     if (!targets || !repo->cache)
         return;
 
-    alpm_list_t *node;
-    for (node = repo->cache->list; node; node = node->next) {
-        struct pkg *pkg = node->data;
+    _cleanup_free_ struct pkg **dropped = calloc(repo->cache->entries + 1, sizeof(struct pkg *));
+    check_null(dropped, "failed to allocate package list");
 
+    size_t count = 0;
+    struct pkg *pkg;
+    pkgcache_foreach(repo->cache, pkg) {
         if (match_targets(pkg, targets)) {
             trace("dropping %s\n", pkg->name);
 
-            repo->cache = _alpm_pkghash_remove(repo->cache, pkg, NULL);
-            unlink_pkg(repo, pkg);
-            package_free(pkg);
+            pkgcache_remove(repo->cache, pkg);
+            dropped[count++] = pkg;
             repo->dirty = true;
         }
     }
+
+    unlink_pkgs(repo, dropped, count);
+    for (size_t i = 0; i < count; ++i)
+        package_free(dropped[i]);
 }
 
 static void list_repo(struct repo *repo)
 {
-    alpm_list_t *node;
-    for (node = repo->cache->list; node; node = node->next) {
-        struct pkg *pkg = node->data;
-
+    struct pkg *pkg;
+    pkgcache_foreach(repo->cache, pkg)
         printf("%s %s\n", pkg->name, pkg->version);
-    }
 }
 
 static void reduce_repo(struct repo *repo)
@@ -229,37 +469,59 @@ static void reduce_repo(struct repo *repo)
     if (!repo->cache)
         return;
 
-    alpm_list_t *node;
-    for (node = repo->cache->list; node; node = node->next) {
-        struct pkg *pkg = node->data;
+    const size_t entries = repo->cache->entries;
+    _cleanup_free_ struct pkg **pkgs = calloc(entries + 1, sizeof(struct pkg *));
+    _cleanup_free_ struct fsop *ops = calloc(entries + 1, sizeof(struct fsop));
+    if (!pkgs || !ops)
+        err(EXIT_FAILURE, "failed to allocate package list");
+
+    size_t count = 0;
+    struct pkg *pkg;
+    pkgcache_foreach(repo->cache, pkg) {
+        pkgs[count] = pkg;
+        ops[count++] = (struct fsop){
+            .type = FSOP_STAT,
+            .dirfd = repo->poolfd,
+            .path = pkg->filename
+        };
+    }
 
-        if (faccessat(repo->poolfd, pkg->filename, F_OK, 0) < 0) {
-            if (errno != ENOENT)
-                err(EXIT_FAILURE, "couldn't access package %s", pkg->filename);
+    fsops_run(ops, count);
 
-            trace("dropping %s\n", pkg->name);
-            repo->cache = _alpm_pkghash_remove(repo->cache, pkg, NULL);
-            unlink_pkg(repo, pkg);
-            package_free(pkg);
-            repo->dirty = true;
+    size_t dropped = 0;
+    for (size_t i = 0; i < count; ++i) {
+        if (ops[i].result == 0)
+            continue;
+        if (ops[i].result != -ENOENT) {
+            errno = -ops[i].result;
+            err(EXIT_FAILURE, "couldn't access package %s", pkgs[i]->filename);
         }
+
+        trace("dropping %s\n", pkgs[i]->name);
+        pkgcache_remove(repo->cache, pkgs[i]);
+        pkgs[dropped++] = pkgs[i];
+        repo->dirty = true;
     }
+
+    unlink_pkgs(repo, pkgs, dropped);
+    for (size_t i = 0; i < dropped; ++i)
+        package_free(pkgs[i]);
 }
 
-static void update_repo(struct repo *repo, alpm_pkghash_t *src)
+static void update_repo(struct repo *repo, struct pkgcache *src)
 {
     if (!repo->cache)
-        repo->cache = _alpm_pkghash_create(src->entries);
+        repo->cache = pkgcache_new(src->entries);
 
-    alpm_list_t *node;
-    for (node = src->list; node; node = node->next) {
-        struct pkg *pkg = node->data;
-        struct pkg *old = _alpm_pkghash_find(repo->cache, pkg->name);
+    struct pkg *pkg;
+    pkgcache_foreach(src, pkg) {
+        struct pkg *old = pkgcache_find(repo->cache, pkg->name);
 
         if (!old) {
             /* The package isn't already in the database. Just add it */
             trace("adding %s %s\n", pkg->name, pkg->version);
-            repo->cache = _alpm_pkghash_add(repo->cache, pkg);
+            pkgcache_add(repo->cache, pkg);
+            repo->changed = alpm_list_add(repo->changed, pkg);
             repo->dirty = true;
             continue;
         }
@@ -281,16 +543,21 @@ static void update_repo(struct repo *repo, alpm_pkghash_t *src)
             } else if (old->base64sig == NULL && pkg->base64sig) {
                 trace("adding signature for %s\n", pkg->name);
             } else {
+                package_free(pkg);
                 continue;
             }
             break;
         default:
+            package_free(pkg);
             continue;
         }
 
-        repo->cache = _alpm_pkghash_replace(repo->cache, pkg, old);
+        pkgcache_replace(repo->cache, pkg, old);
         unlink_pkg(repo, pkg);
+        if (!streq(pkg->filename, old->filename))
+            unlink_pkg(repo, old);
         package_free(old);
+        repo->changed = alpm_list_add(repo->changed, pkg);
         repo->dirty = true;
     }
 }
@@ -313,7 +580,7 @@ static int load_db(struct repo *repo, const char *filename)
         return -1;
     }
 
-    if (load_database(dbfd, &repo->cache) < 0) {
+    if (load_database(dbfd, repo->cache, repo->db_arena) < 0) {
         warn("failed to open %s database", filename);
         return -1;
     }
@@ -349,12 +616,32 @@ static int init_repo(struct repo *repo, const char *reponame, bool files,
     if (repo->pool) {
         repo->poolfd = open(repo->pool, O_RDONLY | O_DIRECTORY);
         check_posix(repo->poolfd, "failed to open pool directory %s", repo->pool);
+
+        /* A pool that's really the root has nothing to link, and nothing
+         * in it must ever be unlinked as if it were a link */
+        struct stat root_st, pool_st;
+        check_posix(fstat(repo->rootfd, &root_st), "failed to stat root directory %s", repo->root);
+        check_posix(fstat(repo->poolfd, &pool_st), "failed to stat pool directory %s", repo->pool);
+        if (root_st.st_dev == pool_st.st_dev && root_st.st_ino == pool_st.st_ino) {
+            close(repo->poolfd);
+            repo->poolfd = repo->rootfd;
+            repo->pool = NULL;
+        }
+    }
+
+    if (repo->pool) {
+
+        /* Symlinks need an absolute path into the pool. Resolve it once
+         * here rather than once per package */
+        repo->poolpath = canonicalize_file_name(repo->pool);
+        check_null(repo->poolpath, "failed to resolve pool directory %s", repo->pool);
     } else {
         repo->poolfd = repo->rootfd;
     }
 
     repo->dbname = joinstring(reponame, ".db", NULL);
     repo->filesname = joinstring(reponame, ".files", NULL);
+    repo->cachename = joinstring(reponame, ".cache", NULL);
 
     if (!files && faccessat(repo->rootfd, repo->filesname, F_OK, 0) < 0) {
         if (errno == ENOENT) {
@@ -372,7 +659,8 @@ static int init_repo(struct repo *repo, const char *reponame, bool files,
     }
 
     if (load_cache) {
-        repo->cache = _alpm_pkghash_create(100);
+        repo->cache = pkgcache_new(100);
+        repo->db_arena = arena_new();
 
         if (load_db(repo, repo->dbname) < 0) {
             /* Database doesn't exist. Mark it dirty so we force its
@@ -448,6 +736,15 @@ int main(int argc, char *argv[])
         { "reflink",  no_argument,       0, 0x100 },
         { "rebuild",  no_argument,       0, 0x101 },
         { "elephant", no_argument,       0, 0x102 },
+        { "jobs",     required_argument, 0, 0x103 },
+        { "threads",  required_argument, 0, 0x104 },
+        { "zstd",     no_argument,       0, 0x105 },
+        { "lz4",      no_argument,       0, 0x106 },
+        { "compression-level", required_argument, 0, 0x107 },
+        { "zstd-long", optional_argument, 0, 0x108 },
+        { "hardlink", no_argument,       0, 0x109 },
+        { "noatime",  no_argument,       0, 0x10a },
+        { "max-inflight", required_argument, 0, 0x10b },
         { 0, 0, 0, 0 }
     };
 
@@ -513,6 +810,42 @@ int main(int argc, char *argv[])
         case 0x102:
             elephant();
             break;
+        case 0x103:
+            if (parse_int(optarg, &config.jobs) < 0 || config.jobs < 1)
+                errx(EXIT_FAILURE, "invalid number of jobs: %s", optarg);
+            break;
+        case 0x104:
+            if (parse_int(optarg, &config.threads) < 0 || config.threads < 1)
+                errx(EXIT_FAILURE, "invalid number of threads: %s", optarg);
+            break;
+        case 0x105:
+            config.compression = ARCHIVE_FILTER_ZSTD;
+            break;
+        case 0x106:
+            config.compression = ARCHIVE_FILTER_LZ4;
+            break;
+        case 0x107:
+            if (parse_int(optarg, &config.compression_level) < 0)
+                errx(EXIT_FAILURE, "invalid compression level: %s", optarg);
+            break;
+        case 0x108:
+            config.zstd_long = 27;
+            if (optarg && (parse_int(optarg, &config.zstd_long) < 0 ||
+                           config.zstd_long < 10 || config.zstd_long > 31))
+                errx(EXIT_FAILURE, "invalid zstd window: %s", optarg);
+            break;
+        case 0x109:
+            config.hardlink = true;
+            break;
+        case 0x10a:
+            config.noatime = true;
+            break;
+        case 0x10b:
+            if (parse_size(optarg, &config.max_inflight) < 0 || !config.max_inflight ||
+                config.max_inflight > SIZE_MAX >> 20)
+                errx(EXIT_FAILURE, "invalid in-flight limit: %s", optarg);
+            config.max_inflight <<= 20;
+            break;
         }
     }
 
@@ -528,6 +861,19 @@ int main(int argc, char *argv[])
         config.arch = strdup(uts.machine);
     }
 
+    if (!config.jobs)
+        config.jobs = worker_count();
+    if (!config.threads)
+        config.threads = worker_count();
+
+    ingest_configure(config.noatime, config.max_inflight);
+
+    if (config.zstd_long && config.compression != ARCHIVE_FILTER_ZSTD)
+        errx(EXIT_FAILURE, "--zstd-long only applies to zstd compression");
+
+    if (config.reflink && config.hardlink)
+        errx(EXIT_FAILURE, "--reflink and --hardlink are mutually exclusive");
+
     if (list && drop)
         errx(EXIT_FAILURE, "List and drop operations are mutually exclusive");
 
@@ -554,22 +900,58 @@ int main(int argc, char *argv[])
             targets = load_manifest(&repo, rootname);
         }
 
-        alpm_pkghash_t *filecache = get_filecache(repo.poolfd, targets, config.arch);
+        /* Don't trust previous scans when asked to rebuild, but still
+           record this one for next time */
+        struct scancache *scancache = rebuild ? scancache_new()
+                                              : scancache_load(repo.rootfd, repo.cachename);
+
+        /* When nothing is known about the repo yet, every package we
+           find will be written out, so read everything we need for
+           that in the same pass that reads the .PKGINFO */
+        int ingest = 0;
+        if (!repo.cache || !repo.cache->entries)
+            ingest = PKG_LOAD_SHA256 | (repo.filesname ? PKG_LOAD_FILES : 0);
+
+        repo.pool_arena = arena_new();
+        struct pkgcache *filecache = get_filecache(repo.poolfd, targets, config.arch,
+                                                   ingest, config.jobs, scancache,
+                                                   repo.pool_arena);
         check_null(filecache, "failed to get filecache");
 
+        if (scancache_save(scancache, repo.rootfd, repo.cachename) < 0)
+            warn("failed to write scan cache %s", repo.cachename);
+        scancache_free(scancache);
+
         reduce_repo(&repo);
         update_repo(&repo, filecache);
+        pkgcache_free(filecache);
     }
 
     if (!repo.dirty) {
         trace("repo does not need updating\n");
     } else {
-        write_database(&repo, repo.dbname, DB_DESC | DB_DEPENDS);
-
-        if (repo.filesname) {
-            write_database(&repo, repo.filesname, DB_FILES);
-        }
+        write_databases(&repo);
 
         link_db(&repo);
     }
+
+    if (repo.cache) {
+        struct pkg *pkg;
+        pkgcache_foreach(repo.cache, pkg)
+            package_free(pkg);
+        pkgcache_free(repo.cache);
+    }
+    alpm_list_free(repo.changed);
+    free(repo.poolpath);
+    arena_free(repo.db_arena);
+    arena_free(repo.pool_arena);
+
+    struct intern_stats stats;
+    intern_stats(&stats);
+    if (stats.lookups) {
+        trace("interned %zu strings (%.1f KiB) for %zu lookups, %.1f%% hits, %.1f KiB saved\n",
+              stats.strings, stats.bytes / 1024.0, stats.lookups,
+              100.0 * stats.hits / stats.lookups, stats.saved / 1024.0);
+    }
+    intern_release();
 }
@@ -1,26 +1,46 @@
 #pragma once
 
 #include <stdbool.h>
-#include "pkghash.h"
+#include "pkgcache.h"
+#include "arena.h"
 #include "util.h"
 
 struct repo {
     const char *root;
     const char *pool;
+    char *poolpath;
     int rootfd;
     int poolfd;
 
     char *dbname;
     char *filesname;
+    char *cachename;
 
     bool dirty;
-    alpm_pkghash_t *cache;
+    struct pkgcache *cache;
+
+    /* Packages added or replaced this run, which are the only ones that
+     * need linking into the repo */
+    alpm_list_t *changed;
+
+    /* Package records loaded from the database and the pool. Packages
+     * from the pool end up in the cache too, so both arenas live as
+     * long as the repo does. */
+    struct arena *db_arena;
+    struct arena *pool_arena;
 };
 
 struct config {
     int verbose;
     int compression;
+    int compression_level;
+    int zstd_long;
+    int jobs;
+    int threads;
     bool reflink;
+    bool hardlink;
+    bool noatime;
+    size_t max_inflight;
     bool sign;
     char *arch;
 };
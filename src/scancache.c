@@ -0,0 +1,385 @@
+#include "scancache.h"
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdbool.h>
+#include <string.h>
+#include <inttypes.h>
+#include <errno.h>
+#include <err.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <archive.h>
+#include <archive_entry.h>
+#include <sys/stat.h>
+
+#include "repose.h"
+#include "package.h"
+#include "database.h"
+#include "buffer.h"
+#include "desc.h"
+#include "mapping.h"
+#include "util.h"
+
+/* The scan cache is an uncompressed tar archive with one member per
+ * pool file. Each member starts with a line holding the stat identity
+ * of the file it was generated from, followed by the package metadata
+ * in desc format. Files which turned out not to be packages only
+ * carry the identity line.
+ *
+ * A run only looks up the files it's interested in. Entries it never
+ * touched are carried over as they are, so that a targeted run doesn't
+ * cost the next full one its cache; only entries for files that are
+ * gone from the pool are dropped. */
+struct scanentry {
+    char *filename;
+    char *data;
+    size_t len;
+    size_t header_len;
+    bool stored;
+    bool present;
+};
+
+struct scancache {
+    struct scanentry *entries;
+    size_t count;
+
+    struct scanentry *next;
+    size_t next_count;
+};
+
+static int scanentry_cmp(const void *p1, const void *p2)
+{
+    const struct scanentry *e1 = p1;
+    const struct scanentry *e2 = p2;
+    return strcmp(e1->filename, e2->filename);
+}
+
+static int scanentry_keycmp(const void *key, const void *p)
+{
+    const struct scanentry *e = p;
+    return strcmp(key, e->filename);
+}
+
+static int format_identity(char *buf, size_t len, const struct stat *st)
+{
+    return snprintf(buf, len, "%ju %ju %jd %jd.%09ld\n",
+                    (uintmax_t)st->st_dev, (uintmax_t)st->st_ino,
+                    (intmax_t)st->st_size, (intmax_t)st->st_mtim.tv_sec,
+                    st->st_mtim.tv_nsec);
+}
+
+static int read_entry(struct archive *archive, struct archive_entry *e,
+                      struct scanentry *entry)
+{
+    int64_t size = archive_entry_size(e);
+
+    *entry = (struct scanentry){0};
+    if (size <= 0)
+        return -1;
+
+    *entry = (struct scanentry){
+        .filename = strdup(archive_entry_pathname(e)),
+        .data = malloc(size + 1),
+        .len = size
+    };
+
+    if (archive_read_data(archive, entry->data, size) != size)
+        return -1;
+    entry->data[size] = 0;
+
+    const char *eol = memchr(entry->data, '\n', entry->len);
+    if (!eol)
+        return -1;
+
+    entry->header_len = eol - entry->data + 1;
+    return 0;
+}
+
+static void scanentry_free(struct scanentry *entry)
+{
+    free(entry->filename);
+    free(entry->data);
+}
+
+static void scancache_clear(struct scancache *cache)
+{
+    for (size_t i = 0; i < cache->count; ++i)
+        scanentry_free(&cache->entries[i]);
+    free(cache->entries);
+    cache->entries = NULL;
+    cache->count = 0;
+}
+
+static int scancache_read(struct scancache *cache, int fd)
+{
+    struct archive *archive = archive_read_new();
+    struct archive_entry *e;
+    size_t buflen = 0;
+    int ret = 0;
+
+    archive_read_support_filter_all(archive);
+    archive_read_support_format_all(archive);
+
+    struct mapping map;
+    int opened;
+    if (mapping_open(&map, fd) == 0)
+        opened = archive_read_open_memory(archive, map.data, map.len);
+    else
+        opened = archive_read_open_fd(archive, fd, READ_BLOCK_SIZE);
+
+    if (opened != ARCHIVE_OK) {
+        archive_read_free(archive);
+        mapping_close(&map);
+        return -1;
+    }
+
+    for (;;) {
+        int status = archive_read_next_header(archive, &e);
+        if (status == ARCHIVE_EOF)
+            break;
+        if (status != ARCHIVE_OK) {
+            ret = -1;
+            break;
+        }
+
+        if (cache->count == buflen) {
+            buflen = buflen ? buflen * 2 : 1024;
+            cache->entries = realloc(cache->entries, buflen * sizeof(struct scanentry));
+            check_null(cache->entries, "failed to allocate scan cache");
+        }
+
+        struct scanentry *entry = &cache->entries[cache->count++];
+        if (read_entry(archive, e, entry) < 0) {
+            ret = -1;
+            break;
+        }
+    }
+
+    archive_read_close(archive);
+    archive_read_free(archive);
+    mapping_close(&map);
+
+    if (ret < 0)
+        return ret;
+
+    qsort(cache->entries, cache->count, sizeof(struct scanentry), scanentry_cmp);
+    return 0;
+}
+
+struct scancache *scancache_new(void)
+{
+    struct scancache *cache = calloc(1, sizeof(struct scancache));
+    check_null(cache, "failed to allocate scan cache");
+    return cache;
+}
+
+struct scancache *scancache_load(int dirfd, const char *filename)
+{
+    struct scancache *cache = scancache_new();
+
+    _cleanup_close_ int fd = openat(dirfd, filename, O_RDONLY);
+    if (fd < 0) {
+        if (errno != ENOENT)
+            warn("failed to open scan cache %s", filename);
+        return cache;
+    }
+
+    if (scancache_read(cache, fd) < 0) {
+        warnx("scan cache %s is corrupt, ignoring it", filename);
+        scancache_clear(cache);
+    }
+
+    return cache;
+}
+
+/* Forget the entries for files no longer in the pool */
+void scancache_prune(struct scancache *cache, char *const *filenames, size_t count)
+{
+    for (size_t i = 0; i < count; ++i) {
+        struct scanentry *entry = bsearch(filenames[i], cache->entries, cache->count,
+                                          sizeof(struct scanentry), scanentry_keycmp);
+        if (entry)
+            entry->present = true;
+    }
+
+    for (size_t i = 0; i < cache->count; ++i) {
+        struct scanentry *entry = &cache->entries[i];
+        if (!entry->present) {
+            free(entry->data);
+            entry->data = NULL;
+        }
+    }
+}
+
+void scancache_begin(struct scancache *cache, size_t count)
+{
+    cache->next = calloc(count, sizeof(struct scanentry));
+    check_null(cache->next, "failed to allocate scan cache");
+    cache->next_count = count;
+}
+
+int scancache_lookup(struct scancache *cache, size_t idx, const char *filename,
+                     const struct stat *st, struct arena *arena, struct pkg **pkg)
+{
+    char identity[128];
+    size_t identity_len = format_identity(identity, sizeof(identity), st);
+
+    struct scanentry *entry = bsearch(filename, cache->entries, cache->count,
+                                      sizeof(struct scanentry), scanentry_keycmp);
+    if (!entry)
+        return 0;
+
+    if (entry->header_len != identity_len || !strneq(entry->data, identity, identity_len))
+        return 0;
+
+    *pkg = NULL;
+    if (entry->len > entry->header_len) {
+        struct pkg *cached = package_new(arena);
+        cached->mtime = st->st_mtime;
+
+        struct desc_parser parser;
+        desc_parser_init(&parser);
+        ssize_t ret = desc_parser_feed(&parser, cached, &entry->data[entry->header_len],
+                                       entry->len - entry->header_len);
+        desc_parser_release(&parser);
+        if (ret < 0 || !cached->name) {
+            package_free(cached);
+            return 0;
+        }
+
+        package_set(cached, PKG_FILENAME, filename, strlen(filename));
+        cached->size = st->st_size;
+        *pkg = cached;
+    }
+
+    /* Entries are unique per file, so only one worker ever touches a
+     * given slot; hand the old record over to the next generation. The
+     * filename stays behind so the table remains searchable. */
+    cache->next[idx] = *entry;
+    cache->next[idx].filename = strdup(filename);
+    entry->data = NULL;
+    entry->len = 0;
+    return 1;
+}
+
+void scancache_store(struct scancache *cache, size_t idx, const char *filename,
+                     const struct stat *st, struct pkg *pkg)
+{
+    struct buffer buf = {0};
+    char identity[128];
+
+    /* Whatever was cached for this file before is stale now */
+    struct scanentry *old = bsearch(filename, cache->entries, cache->count,
+                                    sizeof(struct scanentry), scanentry_keycmp);
+    if (old) {
+        free(old->data);
+        old->data = NULL;
+    }
+
+    format_identity(identity, sizeof(identity), st);
+    buffer_puts(&buf, identity);
+    size_t header_len = buf.len;
+
+    if (pkg)
+        compile_package_metadata(pkg, &buf);
+
+    cache->next[idx] = (struct scanentry){
+        .filename = strdup(filename),
+        .data = buf.data,
+        .len = buf.len,
+        .header_len = header_len,
+        .stored = true
+    };
+}
+
+static void write_entry(struct archive *archive, struct archive_entry *e,
+                        const struct scanentry *entry)
+{
+    archive_entry_set_pathname(e, entry->filename);
+    archive_entry_set_filetype(e, AE_IFREG);
+    archive_entry_set_perm(e, 0644);
+    archive_entry_set_size(e, entry->len);
+    archive_write_header(archive, e);
+    archive_write_data(archive, entry->data, entry->len);
+    archive_entry_clear(e);
+}
+
+static int scancache_write(struct scancache *cache, int fd)
+{
+    struct archive *archive = archive_write_new();
+    struct archive_entry *e = archive_entry_new();
+    int ret = 0;
+
+    archive_write_set_format_pax_restricted(archive);
+
+    if (archive_write_open_fd(archive, fd) != ARCHIVE_OK) {
+        ret = -1;
+        goto cleanup;
+    }
+
+    /* Entries looked up this run had their data handed over to the
+     * next generation, so anything left behind was never looked at */
+    for (size_t i = 0; i < cache->next_count; ++i) {
+        if (cache->next[i].data)
+            write_entry(archive, e, &cache->next[i]);
+    }
+    for (size_t i = 0; i < cache->count; ++i) {
+        if (cache->entries[i].data)
+            write_entry(archive, e, &cache->entries[i]);
+    }
+
+    if (archive_write_close(archive) != ARCHIVE_OK)
+        ret = -1;
+
+cleanup:
+    archive_entry_free(e);
+    archive_write_free(archive);
+    return ret;
+}
+
+int scancache_save(struct scancache *cache, int dirfd, const char *filename)
+{
+    size_t used = 0;
+    bool dirty = false;
+    for (size_t i = 0; i < cache->next_count; ++i) {
+        if (cache->next[i].data)
+            ++used;
+        if (cache->next[i].stored)
+            dirty = true;
+    }
+    for (size_t i = 0; i < cache->count; ++i) {
+        if (cache->entries[i].data)
+            ++used;
+    }
+
+    /* Nothing new was learned and no stale entries were dropped */
+    if (!dirty && used == cache->count)
+        return 0;
+
+    trace("writing %s...\n", filename);
+
+    _cleanup_free_ char *tmpname = joinstring(filename, ".tmp", NULL);
+    _cleanup_close_ int fd = openat(dirfd, tmpname, O_CREAT | O_WRONLY | O_TRUNC, 0644);
+    if (fd < 0)
+        return -1;
+
+    if (scancache_write(cache, fd) < 0) {
+        unlinkat(dirfd, tmpname, 0);
+        return -1;
+    }
+
+    return renameat(dirfd, tmpname, dirfd, filename);
+}
+
+void scancache_free(struct scancache *cache)
+{
+    if (!cache)
+        return;
+
+    scancache_clear(cache);
+    for (size_t i = 0; i < cache->next_count; ++i)
+        scanentry_free(&cache->next[i]);
+    free(cache->next);
+    free(cache);
+}
@@ -0,0 +1,19 @@
+#pragma once
+
+#include <stddef.h>
+#include <sys/stat.h>
+#include "package.h"
+
+struct scancache;
+
+struct scancache *scancache_new(void);
+struct scancache *scancache_load(int dirfd, const char *filename);
+int scancache_save(struct scancache *cache, int dirfd, const char *filename);
+void scancache_free(struct scancache *cache);
+
+void scancache_prune(struct scancache *cache, char *const *filenames, size_t count);
+void scancache_begin(struct scancache *cache, size_t count);
+int scancache_lookup(struct scancache *cache, size_t idx, const char *filename,
+                     const struct stat *st, struct arena *arena, struct pkg **pkg);
+void scancache_store(struct scancache *cache, size_t idx, const char *filename,
+                     const struct stat *st, struct pkg *pkg);
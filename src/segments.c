@@ -0,0 +1,248 @@
+#include "segments.h"
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <inttypes.h>
+#include <errno.h>
+#include <err.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <archive.h>
+#define ZLIB_CONST
+#include <zlib.h>
+#include <zstd.h>
+#include <sys/stat.h>
+
+#include "buffer.h"
+#include "util.h"
+
+struct segindex {
+    struct segment *segments;
+    size_t count;
+    size_t size;
+    bool sorted;
+};
+
+static int gzip_compress(const char *data, size_t len, int level, struct buffer *out)
+{
+    z_stream stream = {0};
+
+    /* A window of 15 bits plus 16 asks for a gzip header and trailer,
+     * making each segment a complete gzip member on its own */
+    if (deflateInit2(&stream, level ? level : Z_DEFAULT_COMPRESSION, Z_DEFLATED, 15 + 16,
+                     8, Z_DEFAULT_STRATEGY) != Z_OK)
+        return -1;
+
+    const size_t bound = deflateBound(&stream, len);
+    if (buffer_reserve(out, bound) < 0) {
+        deflateEnd(&stream);
+        return -1;
+    }
+
+    stream.next_in = (const Bytef *)data;
+    stream.avail_in = len;
+    stream.next_out = (Bytef *)&out->data[out->len];
+    stream.avail_out = bound;
+
+    int status = deflate(&stream, Z_FINISH);
+    out->len += stream.total_out;
+    deflateEnd(&stream);
+
+    return status == Z_STREAM_END ? 0 : -1;
+}
+
+/* Each call produces a complete zstd frame */
+static int zstd_compress(const char *data, size_t len, int level, struct buffer *out)
+{
+    const size_t bound = ZSTD_compressBound(len);
+    if (buffer_reserve(out, bound) < 0)
+        return -1;
+
+    size_t nbytes = ZSTD_compress(&out->data[out->len], bound, data, len,
+                                  level ? level : ZSTD_CLEVEL_DEFAULT);
+    if (ZSTD_isError(nbytes))
+        return -1;
+
+    out->len += nbytes;
+    return 0;
+}
+
+bool segment_supported(int filter)
+{
+    return filter == ARCHIVE_FILTER_GZIP || filter == ARCHIVE_FILTER_ZSTD;
+}
+
+/* A level of 0 picks the compressor's default */
+int segment_compress(int filter, int level, const char *data, size_t len, struct buffer *out)
+{
+    switch (filter) {
+    case ARCHIVE_FILTER_GZIP:
+        return gzip_compress(data, len, level, out);
+    case ARCHIVE_FILTER_ZSTD:
+        return zstd_compress(data, len, level, out);
+    default:
+        errno = EINVAL;
+        return -1;
+    }
+}
+
+static int format_identity(char *buf, size_t len, int dbfd)
+{
+    struct stat st;
+    if (fstat(dbfd, &st) < 0)
+        return -1;
+
+    return snprintf(buf, len, "%ju %ju %jd %jd.%09ld\n",
+                    (uintmax_t)st.st_dev, (uintmax_t)st.st_ino,
+                    (intmax_t)st.st_size, (intmax_t)st.st_mtim.tv_sec,
+                    st.st_mtim.tv_nsec);
+}
+
+static int segment_cmp(const void *p1, const void *p2)
+{
+    const struct segment *s1 = p1;
+    const struct segment *s2 = p2;
+    return strcmp(s1->key, s2->key);
+}
+
+static int segment_keycmp(const void *key, const void *p)
+{
+    const struct segment *s = p;
+    return strcmp(key, s->key);
+}
+
+struct segindex *segindex_new(void)
+{
+    struct segindex *index = calloc(1, sizeof(struct segindex));
+    check_null(index, "failed to allocate segment index");
+    return index;
+}
+
+static void segindex_clear(struct segindex *index)
+{
+    for (size_t i = 0; i < index->count; ++i)
+        free(index->segments[i].key);
+    free(index->segments);
+    index->segments = NULL;
+    index->count = index->size = 0;
+}
+
+static int segindex_read(struct segindex *index, FILE *fp, int dbfd)
+{
+    _cleanup_free_ char *line = NULL;
+    size_t buflen = 0;
+    char identity[128];
+
+    /* An index written for some other database is useless */
+    if (format_identity(identity, sizeof(identity), dbfd) < 0)
+        return -1;
+    if (getline(&line, &buflen, fp) < 0 || !streq(line, identity))
+        return -1;
+
+    while (getline(&line, &buflen, fp) > 0) {
+        char key[128];
+        intmax_t offset;
+        size_t len;
+
+        if (sscanf(line, "%127s %jd %zu", key, &offset, &len) != 3 || offset < 0)
+            return -1;
+        segindex_add(index, key, offset, len);
+    }
+
+    return ferror(fp) ? -1 : 0;
+}
+
+struct segindex *segindex_load(int dirfd, const char *filename, int dbfd)
+{
+    struct segindex *index = segindex_new();
+    if (dbfd < 0)
+        return index;
+
+    _cleanup_fclose_ FILE *fp = fopenat(dirfd, filename, "r");
+    if (fp == NULL) {
+        if (errno != ENOENT)
+            warn("failed to open segment index %s", filename);
+        return index;
+    }
+
+    if (segindex_read(index, fp, dbfd) < 0)
+        segindex_clear(index);
+
+    return index;
+}
+
+static int segindex_write(struct segindex *index, int fd, int dbfd)
+{
+    _cleanup_fclose_ FILE *fp = fdopen(fd, "w");
+    if (fp == NULL) {
+        close(fd);
+        return -1;
+    }
+
+    char identity[128];
+    if (format_identity(identity, sizeof(identity), dbfd) < 0)
+        return -1;
+
+    fputs(identity, fp);
+    for (size_t i = 0; i < index->count; ++i) {
+        const struct segment *segment = &index->segments[i];
+        fprintf(fp, "%s %jd %zu\n", segment->key, (intmax_t)segment->offset, segment->len);
+    }
+
+    return fflush(fp) == 0 && !ferror(fp) ? 0 : -1;
+}
+
+int segindex_save(struct segindex *index, int dirfd, const char *filename, int dbfd)
+{
+    _cleanup_free_ char *tmpname = joinstring(filename, ".tmp", NULL);
+    int fd = openat(dirfd, tmpname, O_CREAT | O_WRONLY | O_TRUNC, 0644);
+    if (fd < 0)
+        return -1;
+
+    if (segindex_write(index, fd, dbfd) < 0) {
+        unlinkat(dirfd, tmpname, 0);
+        return -1;
+    }
+
+    return renameat(dirfd, tmpname, dirfd, filename);
+}
+
+void segindex_free(struct segindex *index)
+{
+    if (!index)
+        return;
+
+    segindex_clear(index);
+    free(index);
+}
+
+const struct segment *segindex_find(struct segindex *index, const char *key)
+{
+    if (index->count == 0)
+        return NULL;
+
+    if (!index->sorted) {
+        qsort(index->segments, index->count, sizeof(struct segment), segment_cmp);
+        index->sorted = true;
+    }
+
+    return bsearch(key, index->segments, index->count,
+                   sizeof(struct segment), segment_keycmp);
+}
+
+void segindex_add(struct segindex *index, const char *key, off_t offset, size_t len)
+{
+    if (index->count == index->size) {
+        index->size = index->size ? index->size * 2 : 1024;
+        index->segments = realloc(index->segments, index->size * sizeof(struct segment));
+        check_null(index->segments, "failed to allocate segment index");
+    }
+
+    index->segments[index->count++] = (struct segment){
+        .key = strdup(key),
+        .offset = offset,
+        .len = len
+    };
+    index->sorted = false;
+}
@@ -0,0 +1,35 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <sys/types.h>
+
+struct buffer;
+
+/* Both gzip and zstd streams may be made up of any number of
+ * independently compressed members. A database compressed one package
+ * at a time can then be updated by copying the members of unchanged
+ * packages out of the previous one, and compressing only the rest.
+ *
+ * The segment index is the sidecar recording where each package's
+ * member lives in a database, keyed by a hash of everything that goes
+ * into it. It's only trusted while the database is the one it was
+ * written for. */
+struct segment {
+    char *key;
+    off_t offset;
+    size_t len;
+};
+
+struct segindex;
+
+bool segment_supported(int filter);
+int segment_compress(int filter, int level, const char *data, size_t len, struct buffer *out);
+
+struct segindex *segindex_new(void);
+struct segindex *segindex_load(int dirfd, const char *filename, int dbfd);
+int segindex_save(struct segindex *index, int dirfd, const char *filename, int dbfd);
+void segindex_free(struct segindex *index);
+
+const struct segment *segindex_find(struct segindex *index, const char *key);
+void segindex_add(struct segindex *index, const char *key, off_t offset, size_t len);
@@ -8,6 +8,12 @@
 #include <err.h>
 #include <fcntl.h>
 #include <limits.h>
+#include <sys/ioctl.h>
+#include <sys/stat.h>
+#ifdef __linux__
+  #include <sys/sendfile.h>
+  #include <linux/fs.h>
+#endif
 
 #define WHITESPACE " \t\n\r"
 
@@ -164,6 +170,31 @@ int parse_time(const char *str, time_t *out)
     return 0;
 }
 
+int parse_int(const char *str, int *out)
+{
+    char *end = NULL;
+    errno = 0;
+
+    if (!str || !str[0]) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    long value = strtol(str, &end, 10);
+    if (errno) {
+        return -1;
+    } else if (str == end || (end && *end)) {
+        errno = EINVAL;
+        return -1;
+    } else if (value < INT_MIN || value > INT_MAX) {
+        errno = ERANGE;
+        return -1;
+    }
+
+    *out = (int)value;
+    return 0;
+}
+
 char *hex_representation(unsigned char *bytes, size_t size)
 {
     static const char *hex_digits = "0123456789abcdef";
@@ -194,6 +225,111 @@ char *strstrip(char *s)
 }
 
 
+#ifndef __QNX__
+
+#ifdef __linux__
+#define COPY_CHUNK_SIZE 0x40000000
+
+/* Errors meaning a copy method isn't available for this pair of files,
+ * rather than that the copy itself went wrong */
+static bool copy_unsupported(int error)
+{
+    return error == EOPNOTSUPP || error == ENOTTY || error == ENOSYS ||
+           error == EXDEV || error == EINVAL;
+}
+
+static int copy_range(int dest, int src, off_t len)
+{
+    bool copied = false;
+
+    while (len > 0) {
+        ssize_t nbytes = copy_file_range(src, NULL, dest, NULL,
+                                         len < COPY_CHUNK_SIZE ? len : COPY_CHUNK_SIZE, 0);
+        if (nbytes < 0)
+            return !copied && copy_unsupported(errno) ? 1 : -1;
+        if (nbytes == 0)
+            break;
+
+        copied = true;
+        len -= nbytes;
+    }
+
+    return 0;
+}
+
+static int send_range(int dest, int src, off_t len)
+{
+    bool copied = false;
+
+    while (len > 0) {
+        ssize_t nbytes = sendfile(dest, src, NULL, len < COPY_CHUNK_SIZE ? len : COPY_CHUNK_SIZE);
+        if (nbytes < 0)
+            return !copied && copy_unsupported(errno) ? 1 : -1;
+        if (nbytes == 0)
+            break;
+
+        copied = true;
+        len -= nbytes;
+    }
+
+    return 0;
+}
+#endif
+
+static int write_range(int dest, int src)
+{
+    char buf[BUFSIZ * 16];
+
+    for (;;) {
+        ssize_t nbytes_r = read(src, buf, sizeof(buf));
+        if (nbytes_r < 0 && errno == EINTR)
+            continue;
+        if (nbytes_r <= 0)
+            return nbytes_r;
+
+        for (ssize_t off = 0; off < nbytes_r;) {
+            ssize_t nbytes_w = write(dest, buf + off, nbytes_r - off);
+            if (nbytes_w < 0) {
+                if (errno == EINTR)
+                    continue;
+                return -1;
+            }
+            off += nbytes_w;
+        }
+    }
+}
+
+/* Share the source's extents outright where the filesystem allows it,
+ * and otherwise copy as cheaply as possible: inside the kernel with
+ * copy_file_range, then sendfile, and only then through userspace.
+ * dest is expected to be empty. */
+int copy_file(int dest, int src)
+{
+#ifdef __linux__
+    if (ioctl(dest, FICLONE, src) == 0)
+        return 0;
+    if (!copy_unsupported(errno))
+        return -1;
+
+    struct stat st;
+    if (fstat(src, &st) < 0)
+        return -1;
+
+    int ret = copy_range(dest, src, st.st_size);
+    if (ret <= 0)
+        return ret;
+
+    ret = send_range(dest, src, st.st_size);
+    if (ret <= 0)
+        return ret;
+#endif
+
+    return write_range(dest, src);
+}
+
+#endif
+
+
 #ifdef __QNX__
 
 // QNX shims for glibc and posix 2008.1 functions
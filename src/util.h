@@ -20,6 +20,15 @@
 #define _cleanup_closedir_  _cleanup_(closedirp)
 #define _cleanup_close_     _cleanup_(closep)
 
+/* Pointers handed over only to be compared against NULL. Without it,
+ * GCC assumes the pointee is read and warns about freshly allocated
+ * memory being uninitialized */
+#if !__clang__ && __GNUC__ >= 10
+#define _access_none_(x)    __attribute__((access(none, x)))
+#else
+#define _access_none_(x)
+#endif
+
 /* XXX: clang does not have generic builtin */
 #if __clang__
 #define __builtin_add_overflow(a, b, r) _Generic((a), \
@@ -40,7 +49,7 @@ static inline bool streq(const char *s1, const char *s2) { return strcmp(s1, s2)
 static inline bool strneq(const char *s1, const char *s2, size_t len) { return strncmp(s1, s2, len) == 0; }
 
 void check_posix(intmax_t rc, const char *fmt, ...) _printf_(2, 3);
-void check_null(const void *ptr, const char *fmt, ...) _printf_(2, 3);
+void check_null(const void *ptr, const char *fmt, ...) _printf_(2, 3) _access_none_(1);
 
 FILE *fopenat(int dirfd, const char *path, const char *mode);
 
@@ -48,10 +57,13 @@ char *joinstring(const char *root, ...) _sentinel_;
 
 int parse_size(const char *str, size_t *out);
 int parse_time(const char *str, time_t *out);
+int parse_int(const char *str, int *out);
 
 char *strstrip(char *s);
 char *hex_representation(unsigned char *bytes, size_t size);
 
+int copy_file(int dest, int src);
+
 #ifdef __QNX__
 
 #define O_DIRECTORY 0
@@ -65,7 +77,6 @@ int unlinkat(int dirfd, const char *pathname, int flags);
 
 DIR *fdopendir(int fd);
 
-int copy_file(int dest, int src);
 #define canonicalize_file_name(fname) realpath(fname,NULL);
 
 ssize_t getline(char **lineptr, size_t *n, FILE *stream);
@@ -75,9 +86,5 @@ void *memrchr(const void *s, int c, size_t n);
 char *strndup(const char *s, size_t n);
 char *stpcpy(char *dest, const char *src);
 
-#else /* ! QNX */
-
-#define copy_file(dest, src) ioctl(dest, BTRFS_IOC_CLONE, src);
-
 #endif
 
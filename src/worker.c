@@ -0,0 +1,75 @@
+#include "worker.h"
+
+#include <stdlib.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <errno.h>
+#include <err.h>
+
+#include "util.h"
+
+struct work {
+    atomic_size_t next;
+    size_t count;
+    worker_fn fn;
+    void *arg;
+};
+
+static void *worker_main(void *data)
+{
+    struct work *work = data;
+
+    for (;;) {
+        size_t idx = atomic_fetch_add(&work->next, 1);
+        if (idx >= work->count)
+            break;
+        work->fn(idx, work->arg);
+    }
+
+    return NULL;
+}
+
+int worker_count(void)
+{
+    long n = sysconf(_SC_NPROCESSORS_ONLN);
+    return n > 0 ? (int)n : 1;
+}
+
+/* Run fn over [0, count) on up to jobs threads. Items are handed out
+ * in order, but may complete in any order, so callers should write
+ * results into per-index slots and merge them afterwards. */
+void parallel_for(size_t count, int jobs, worker_fn fn, void *arg)
+{
+    struct work work = {
+        .count = count,
+        .fn = fn,
+        .arg = arg
+    };
+    atomic_init(&work.next, 0);
+
+    if (jobs > 1 && (size_t)jobs > count)
+        jobs = (int)count;
+
+    if (jobs <= 1) {
+        worker_main(&work);
+        return;
+    }
+
+    _cleanup_free_ pthread_t *threads = calloc(jobs - 1, sizeof(pthread_t));
+    check_null(threads, "failed to allocate worker threads");
+
+    for (int i = 0; i < jobs - 1; ++i) {
+        int rc = pthread_create(&threads[i], NULL, worker_main, &work);
+        if (rc != 0) {
+            errno = rc;
+            err(EXIT_FAILURE, "failed to create worker thread");
+        }
+    }
+
+    /* The calling thread pulls its weight too */
+    worker_main(&work);
+
+    for (int i = 0; i < jobs - 1; ++i)
+        pthread_join(threads[i], NULL);
+}
@@ -0,0 +1,8 @@
+#pragma once
+
+#include <stddef.h>
+
+typedef void (*worker_fn)(size_t idx, void *arg);
+
+int worker_count(void);
+void parallel_for(size_t count, int jobs, worker_fn fn, void *arg);
@@ -1,6 +1,10 @@
 #define SIZE_MAX ...
 
 typedef int... time_t;
+typedef int... off_t;
+typedef int... dev_t;
+typedef int... ino_t;
+typedef int... mode_t;
 
 typedef struct __alpm_list_t {
     void *data;
@@ -9,6 +13,7 @@ typedef struct __alpm_list_t {
 } alpm_list_t;
 
 struct pkg {
+    uint64_t name_hash;
     char *filename;
     char *name;
     char *base;
@@ -33,7 +38,8 @@ struct pkg {
     alpm_list_t *optdepends;
     alpm_list_t *makedepends;
     alpm_list_t *checkdepends;
-    alpm_list_t *files;
+    struct filelist *files;
+    struct arena *arena;
     ...;
 };
 
@@ -63,6 +69,187 @@ enum pkg_entry {
     PKG_FILES
 };
 
+struct pkgfile {
+    char *name;
+    char *version;
+    char *arch;
+};
+
+int parse_package_filename(const char *filename, struct pkgfile *pkgfile);
+struct pkg *package_new(struct arena *arena);
+void package_set(struct pkg *pkg, enum pkg_entry type, const char *entry, size_t len);
+void package_free(struct pkg *pkg);
+
+// arena
+struct arena *arena_new(void);
+void arena_free(struct arena *arena);
+void *arena_alloc(struct arena *arena, size_t size);
+char *arena_strndup(struct arena *arena, const char *s, size_t len);
+void arena_splice(struct arena *dst, struct arena *src);
+size_t arena_size(const struct arena *arena);
+
+// pkgcache
+struct pkgcache {
+    size_t count;
+    size_t entries;
+    struct pkg **pkgs;
+    ...;
+};
+
+uint64_t pkgcache_hash(const char *name);
+struct pkgcache *pkgcache_new(size_t size);
+void pkgcache_free(struct pkgcache *cache);
+struct pkg *pkgcache_find(const struct pkgcache *cache, const char *name);
+void pkgcache_add(struct pkgcache *cache, struct pkg *pkg);
+void pkgcache_replace(struct pkgcache *cache, struct pkg *new, struct pkg *old);
+void pkgcache_remove(struct pkgcache *cache, struct pkg *pkg);
+void pkgcache_sort(struct pkgcache *cache);
+
+// intern
+struct intern_stats {
+    size_t lookups;
+    size_t hits;
+    size_t strings;
+    size_t bytes;
+    size_t saved;
+};
+
+char *intern(const char *str, size_t len);
+void intern_stats(struct intern_stats *stats);
+void intern_release(void);
+
+// buffer
+struct buffer {
+    char *data;
+    size_t len;
+    ...;
+};
+
+void buffer_release(struct buffer *buf);
+void buffer_clear(struct buffer *buf);
+int buffer_append(struct buffer *buf, const char *data, size_t len);
+ssize_t buffer_printf(struct buffer *buf, const char *fmt, ...);
+int buffer_puts(struct buffer *buf, const char *str);
+int buffer_put_uint(struct buffer *buf, uintmax_t value);
+int buffer_put_int(struct buffer *buf, intmax_t value);
+int buffer_put_list(struct buffer *buf, const alpm_list_t *list, char sep);
+
+// filelist
+struct filelist *filelist_new(void);
+void filelist_free(struct filelist *list);
+void filelist_add(struct filelist *list, const char *path, size_t len);
+size_t filelist_count(const struct filelist *list);
+size_t filelist_size(const struct filelist *list);
+int filelist_get(const struct filelist *list, size_t idx, struct buffer *buf);
+void filelist_write(const struct filelist *list, struct buffer *buf);
+
+// libarchive
+#define ARCHIVE_OK ...
+#define ARCHIVE_FILTER_NONE ...
+#define ARCHIVE_FILTER_GZIP ...
+#define ARCHIVE_FILTER_BZIP2 ...
+#define ARCHIVE_FILTER_COMPRESS ...
+#define ARCHIVE_FILTER_XZ ...
+#define ARCHIVE_FILTER_LZ4 ...
+#define ARCHIVE_FILTER_ZSTD ...
+#define AE_IFREG ...
+
+struct archive *archive_write_new(void);
+int archive_write_add_filter(struct archive *, int);
+int archive_write_set_filter_option(struct archive *, const char *, const char *, const char *);
+int archive_write_set_format_raw(struct archive *);
+int archive_write_open_memory(struct archive *, void *, size_t, size_t *);
+int archive_write_header(struct archive *, struct archive_entry *);
+ssize_t archive_write_data(struct archive *, const void *, size_t);
+int archive_write_close(struct archive *);
+int archive_write_free(struct archive *);
+
+struct archive *archive_read_new(void);
+int archive_read_support_filter_all(struct archive *);
+int archive_read_support_format_raw(struct archive *);
+int archive_read_open_memory(struct archive *, const void *, size_t);
+int archive_read_next_header(struct archive *, struct archive_entry **);
+ssize_t archive_read_data(struct archive *, void *, size_t);
+int archive_read_free(struct archive *);
+const char *archive_error_string(struct archive *);
+
+struct archive_entry *archive_entry_new(void);
+void archive_entry_free(struct archive_entry *);
+void archive_entry_set_pathname(struct archive_entry *, const char *);
+void archive_entry_set_filetype(struct archive_entry *, unsigned int);
+
+// segments
+
+struct segment {
+    char *key;
+    off_t offset;
+    size_t len;
+    ...;
+};
+
+bool segment_supported(int filter);
+int segment_compress(int filter, int level, const char *data, size_t len, struct buffer *out);
+struct segindex *segindex_new(void);
+void segindex_free(struct segindex *index);
+const struct segment *segindex_find(struct segindex *index, const char *key);
+void segindex_add(struct segindex *index, const char *key, off_t offset, size_t len);
+
+// fsops
+#define AT_SYMLINK_NOFOLLOW ...
+
+struct timespec {
+    time_t tv_sec;
+    long tv_nsec;
+    ...;
+};
+
+struct stat {
+    dev_t st_dev;
+    ino_t st_ino;
+    mode_t st_mode;
+    off_t st_size;
+    struct timespec st_mtim;
+    ...;
+};
+
+enum fsop_type {
+    FSOP_STAT,
+    FSOP_UNLINK,
+    FSOP_SYMLINK,
+    FSOP_LINK
+};
+
+struct fsop {
+    enum fsop_type type;
+    int dirfd;
+    const char *path;
+    int newdirfd;
+    const char *newpath;
+    int flags;
+    struct stat *st;
+    int result;
+    ...;
+};
+
+void fsops_run(struct fsop *ops, size_t count);
+
+// scancache
+struct scancache *scancache_load(int dirfd, const char *filename);
+int scancache_save(struct scancache *cache, int dirfd, const char *filename);
+void scancache_free(struct scancache *cache);
+
+void scancache_prune(struct scancache *cache, char *const *filenames, size_t count);
+void scancache_begin(struct scancache *cache, size_t count);
+int scancache_lookup(struct scancache *cache, size_t idx, const char *filename,
+                     const struct stat *st, struct arena *arena, struct pkg **pkg);
+void scancache_store(struct scancache *cache, size_t idx, const char *filename,
+                     const struct stat *st, struct pkg *pkg);
+
+// filecache
+struct pkgcache *get_filecache(int dirfd, alpm_list_t *targets, const char *arch,
+                               int flags, int jobs, struct scancache *scancache,
+                               struct arena *arena);
+
 // desc
 struct desc_parser {
     enum pkg_entry entry;
@@ -70,6 +257,7 @@ struct desc_parser {
 };
 
 void desc_parser_init(struct desc_parser *parser);
+void desc_parser_release(struct desc_parser *parser);
 ssize_t desc_parser_feed(struct desc_parser *parser, struct pkg *pkg,
                          char *buf, size_t buf_len);
 
@@ -80,6 +268,7 @@ struct pkginfo_parser {
 };
 
 void pkginfo_parser_init(struct pkginfo_parser *parser);
+void pkginfo_parser_release(struct pkginfo_parser *parser);
 ssize_t pkginfo_parser_feed(struct pkginfo_parser *parser, struct pkg *pkg,
                             char *buf, size_t buf_len);
 
@@ -87,4 +276,7 @@ ssize_t pkginfo_parser_feed(struct pkginfo_parser *parser, struct pkg *pkg,
 char *joinstring(const char *root, ...);
 int parse_size(const char *str, size_t *out);
 int parse_time(const char *size, time_t *out);
+int parse_int(const char *str, int *out);
+int copy_file(int dest, int src);
 char *strstrip(char *s);
+void free(void *ptr);
@@ -1,5 +1,19 @@
 #include <time.h>
+#include <fcntl.h>
 #include <repose.h>
+#include <buffer.h>
+#include <filelist.h>
+#include <intern.h>
+#include <segments.h>
+#include <fsops.h>
+#include <scancache.h>
+#include <filecache.h>
+#include <archive.h>
+#include <archive_entry.h>
 #include <desc.h>
 #include <pkginfo.h>
 #include <util.h>
+
+/* Provided by repose.c in the real program */
+struct config config;
+void trace(const char *fmt, ...) { (void)fmt; }
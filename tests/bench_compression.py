@@ -0,0 +1,175 @@
+import io
+import os
+import tarfile
+import time
+from repose import ffi, lib
+
+
+# Point BENCH_DATABASE at a real .db or .files database to measure that
+# instead of the generated one
+DATABASE = os.environ.get('BENCH_DATABASE')
+PACKAGES = int(os.environ.get('BENCH_PACKAGES', 2000))
+
+DESC = '''%FILENAME%
+{name}-1.0-1-x86_64.pkg.tar.zst
+
+%NAME%
+{name}
+
+%VERSION%
+1.0-1
+
+%DESC%
+The {name} package, for benchmarking database compression
+
+%CSIZE%
+{size}
+
+%ARCH%
+x86_64
+
+%PACKAGER%
+Simon Gomizelj <simongmzlj@gmail.com>
+
+'''
+
+CODECS = [
+    ('bzip2',          lib.ARCHIVE_FILTER_BZIP2,    []),
+    ('xz',             lib.ARCHIVE_FILTER_XZ,       []),
+    ('xz threads',     lib.ARCHIVE_FILTER_XZ,       [('xz', 'threads', '0')]),
+    ('gzip',           lib.ARCHIVE_FILTER_GZIP,     []),
+    ('compress',       lib.ARCHIVE_FILTER_COMPRESS, []),
+    ('lz4',            lib.ARCHIVE_FILTER_LZ4,      []),
+    ('zstd',           lib.ARCHIVE_FILTER_ZSTD,     []),
+    ('zstd -19',       lib.ARCHIVE_FILTER_ZSTD,     [(None, 'compression-level', '19')]),
+    ('zstd long',      lib.ARCHIVE_FILTER_ZSTD,     [('zstd', 'long', '27')]),
+]
+
+SEGMENTED = [
+    ('gzip segments',  lib.ARCHIVE_FILTER_GZIP),
+    ('zstd segments',  lib.ARCHIVE_FILTER_ZSTD),
+]
+
+
+def generate():
+    data = io.BytesIO()
+    with tarfile.open(fileobj=data, mode='w', format=tarfile.PAX_FORMAT) as tar:
+        def add(path, text=None):
+            info = tarfile.TarInfo(path)
+            if text is None:
+                info.type = tarfile.DIRTYPE
+                tar.addfile(info)
+            else:
+                text = text.encode()
+                info.size = len(text)
+                tar.addfile(info, io.BytesIO(text))
+
+        for i in range(PACKAGES):
+            name = 'package{}'.format(i)
+            files = ''.join('usr/share/{}/file{}\n'.format(name, j) for j in range(i % 500))
+
+            add('{}-1.0-1'.format(name))
+            add('{}-1.0-1/desc'.format(name), DESC.format(name=name, size=i * 1024))
+            add('{}-1.0-1/files'.format(name), '%FILES%\n' + files + '\n')
+    return data.getvalue()
+
+
+def decompress(data):
+    archive = lib.archive_read_new()
+    lib.archive_read_support_filter_all(archive)
+    lib.archive_read_support_format_raw(archive)
+    assert lib.archive_read_open_memory(archive, data, len(data)) == lib.ARCHIVE_OK
+
+    entry = ffi.new('struct archive_entry **')
+    assert lib.archive_read_next_header(archive, entry) == lib.ARCHIVE_OK
+
+    chunks = []
+    buf = ffi.new('char[]', 0x100000)
+    while True:
+        nbytes = lib.archive_read_data(archive, buf, len(buf))
+        assert nbytes >= 0, ffi.string(lib.archive_error_string(archive))
+        if nbytes == 0:
+            break
+        chunks.append(ffi.buffer(buf, nbytes)[:])
+
+    lib.archive_read_free(archive)
+    return b''.join(chunks)
+
+
+def compress(data, codec, options):
+    archive = lib.archive_write_new()
+    try:
+        if lib.archive_write_add_filter(archive, codec) != lib.ARCHIVE_OK:
+            return None
+        for module, option, value in options:
+            module = module.encode() if module else ffi.NULL
+            if lib.archive_write_set_filter_option(archive, module, option.encode(),
+                                                   value.encode()) != lib.ARCHIVE_OK:
+                return None
+        lib.archive_write_set_format_raw(archive)
+
+        out = ffi.new('char[]', len(data) * 2 + 0x100000)
+        used = ffi.new('size_t *')
+        assert lib.archive_write_open_memory(archive, out, len(out), used) == lib.ARCHIVE_OK
+
+        entry = lib.archive_entry_new()
+        lib.archive_entry_set_pathname(entry, b'database')
+        lib.archive_entry_set_filetype(entry, lib.AE_IFREG)
+        lib.archive_write_header(archive, entry)
+        lib.archive_entry_free(entry)
+
+        assert lib.archive_write_data(archive, data, len(data)) == len(data)
+        assert lib.archive_write_close(archive) == lib.ARCHIVE_OK
+        return ffi.buffer(out, used[0])[:]
+    finally:
+        lib.archive_write_free(archive)
+
+
+def compress_segments(data, codec):
+    """Compress every package on its own, the way repose writes gzip and
+    zstd databases"""
+    with tarfile.open(fileobj=io.BytesIO(data)) as tar:
+        cuts = [member.offset for member in tar if member.isdir()]
+    cuts = [0] + cuts[1:] + [len(data)]
+
+    out = ffi.new('struct buffer *')
+    try:
+        for start, end in zip(cuts, cuts[1:]):
+            chunk = data[start:end]
+            if lib.segment_compress(codec, 0, chunk, len(chunk), out) < 0:
+                return None
+        return ffi.buffer(out.data, out.len)[:]
+    finally:
+        lib.buffer_release(out)
+
+
+def measure(name, data, fn):
+    start = time.perf_counter()
+    compressed = fn()
+    write = time.perf_counter() - start
+    if compressed is None:
+        print('{:<16} {:>12}'.format(name, 'unsupported'))
+        return
+
+    start = time.perf_counter()
+    assert decompress(compressed) == data
+    read = time.perf_counter() - start
+
+    print('{:<16} {:>9.2f} MiB {:>7.1f}x {:>8.3f}s {:>8.3f}s'.format(
+        name, len(compressed) / 1048576.0, len(data) / len(compressed), write, read))
+
+
+def test_bench_compression():
+    if DATABASE:
+        with open(DATABASE, 'rb') as database:
+            data = decompress(database.read())
+    else:
+        data = generate()
+
+    print('\n{} MiB of uncompressed database'.format(round(len(data) / 1048576.0, 1)))
+    print('{:<16} {:>13} {:>8} {:>9} {:>9}'.format('codec', 'size', 'ratio', 'write', 'read'))
+
+    for name, codec, options in CODECS:
+        measure(name, data, lambda: compress(data, codec, options))
+    for name, codec in SEGMENTED:
+        measure(name, data, lambda: compress_segments(data, codec))
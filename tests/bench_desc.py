@@ -0,0 +1,38 @@
+import os
+import time
+from repose import ffi, lib
+from test_desc import REPOSE_DESC, REPOSE_DEPENDS
+from wrappers import Package
+
+
+ROUNDS = int(os.environ.get('BENCH_ROUNDS', 50))
+CHUNK = 0x10000
+
+FILES = '%FILES%\n' + ''.join('usr/share/locale/{}/LC_MESSAGES/repose-{}.mo\n'.format(i // 8, i)
+                              for i in range(5000)) + '\n'
+
+
+def parse(data):
+    pkg = Package(name='repose-git', version='5.19.g82c3d4a-1')
+    parser = ffi.new('struct desc_parser *')
+    lib.desc_parser_init(parser)
+
+    for i in range(0, len(data), CHUNK):
+        chunk = data[i:i+CHUNK]
+        assert lib.desc_parser_feed(parser, pkg._struct, chunk, len(chunk)) == len(chunk)
+
+    lib.desc_parser_release(parser)
+    lib.filelist_free(pkg._struct.files)
+
+
+def test_bench_desc():
+    data = (REPOSE_DESC + '\n' + REPOSE_DEPENDS + '\n' + FILES).encode()
+
+    start = time.perf_counter()
+    for _ in range(ROUNDS):
+        parse(data)
+    elapsed = time.perf_counter() - start
+
+    total = len(data) * ROUNDS / 1048576.0
+    print('\nparsed {:.1f} MiB of desc text in {:.3f}s, {:.1f} MiB/s'.format(
+        total, elapsed, total / elapsed))
@@ -0,0 +1,45 @@
+import os
+import random
+import time
+from repose import lib
+from wrappers import make_packages
+
+
+COUNT = int(os.environ.get('BENCH_PACKAGES', 50000))
+
+
+def timed(fn, *args):
+    start = time.perf_counter()
+    result = fn(*args)
+    return time.perf_counter() - start, result
+
+
+def pkgcache_insert(pkgs):
+    cache = lib.pkgcache_new(100)
+    for pkg in pkgs:
+        lib.pkgcache_add(cache, pkg)
+    return cache
+
+
+def lookup(find, table, names):
+    for name in names:
+        find(table, name)
+
+
+def test_bench_pkgcache():
+    names = [b'pkg%06d' % i for i in range(COUNT)]
+    random.seed(0)
+    random.shuffle(names)
+    pkgs, keepalive = make_packages(names)
+    misses = [b'missing%06d' % i for i in range(COUNT)]
+
+    insert, cache = timed(pkgcache_insert, pkgs)
+    hit, _ = timed(lookup, lib.pkgcache_find, cache, names)
+    miss, _ = timed(lookup, lib.pkgcache_find, cache, misses)
+    lib.pkgcache_free(cache)
+
+    print('\n{} packages:'.format(COUNT))
+    for label, elapsed in [('insert', insert),
+                           ('lookup hit', hit),
+                           ('lookup miss', miss)]:
+        print('  {:<12} {:.3f}s'.format(label, elapsed))
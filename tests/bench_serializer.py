@@ -0,0 +1,70 @@
+import os
+import time
+from repose import ffi, lib
+
+
+ROUNDS = int(os.environ.get('BENCH_ROUNDS', 200))
+PATHS = [ffi.new('char[]', 'usr/share/locale/{}/LC_MESSAGES/repose-{}.mo'.format(i // 8, i).encode())
+         for i in range(5000)]
+
+
+def report(label, nbytes, elapsed):
+    total = nbytes / 1048576.0
+    print('\n{}: {:.1f} MiB in {:.3f}s, {:.1f} MiB/s'.format(label, total, elapsed, total / elapsed))
+
+
+def bench(label, emit):
+    buf = ffi.new('struct buffer *')
+    nbytes = 0
+
+    start = time.perf_counter()
+    for _ in range(ROUNDS):
+        lib.buffer_clear(buf)
+        emit(buf)
+        nbytes += buf.len
+    elapsed = time.perf_counter() - start
+
+    output = ffi.unpack(buf.data, buf.len)
+    lib.buffer_release(buf)
+    report(label, nbytes, elapsed)
+    return output
+
+
+def test_bench_files_entry():
+    """Render a 5000 path %FILES% entry the way the database writer used
+    to, one buffer_printf per line, and the way it does now, with one
+    buffer_put_list for the whole list. The first also pays for a call
+    from Python per line, so emit the same lines through buffer_puts to
+    separate that from the cost of printf itself."""
+    arena = lib.arena_new()
+    pkg = lib.package_new(arena)
+    for path in PATHS:
+        lib.package_set(pkg, lib.PKG_DEPENDS, path, len(ffi.string(path)))
+
+    header_fmt = ffi.new('char[]', b'%%%s%%\n')
+    line_fmt = ffi.new('char[]', b'%s\n')
+    header = ffi.new('char[]', b'FILES')
+
+    def printf(buf):
+        lib.buffer_printf(buf, header_fmt, header)
+        for path in PATHS:
+            lib.buffer_printf(buf, line_fmt, path)
+        lib.buffer_puts(buf, b'\n')
+
+    def puts(buf):
+        lib.buffer_puts(buf, b'%FILES%\n')
+        for path in PATHS:
+            lib.buffer_puts(buf, path)
+            lib.buffer_puts(buf, b'\n')
+        lib.buffer_puts(buf, b'\n')
+
+    def put_list(buf):
+        lib.buffer_puts(buf, b'%FILES%\n')
+        lib.buffer_put_list(buf, pkg.depends, b'\n')
+        lib.buffer_puts(buf, b'\n')
+
+    expected = bench('buffer_printf per line', printf)
+    assert bench('buffer_puts per line', puts) == expected
+    assert bench('buffer_put_list', put_list) == expected
+
+    lib.arena_free(arena)
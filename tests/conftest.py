@@ -1,11 +1,21 @@
+import os
 import pytest
 import cffi
 
 
 CFLAGS = ['-std=c11', '-O0', '-g', '-D_GNU_SOURCE']
+if os.environ.get('WITH_IO_URING'):
+    CFLAGS.append('-DREPOSE_IO_URING')
 SOURCES = ['../src/desc.c', '../src/pkginfo.c',
-           '../src/package.c', '../src/pkghash.c',
-           '../src/util.c', '../src/base64.c']
+           '../src/package.c', '../src/pkgcache.c',
+           '../src/util.c', '../src/base64.c',
+           '../src/checksum.c', '../src/arena.c',
+           '../src/buffer.c', '../src/filelist.c',
+           '../src/intern.c', '../src/mapping.c',
+           '../src/segments.c', '../src/fsops.c',
+           '../src/ingest.c', '../src/scancache.c',
+           '../src/database.c', '../src/worker.c',
+           '../src/filecache.c', '../src/filters.c']
 
 
 def pytest_configure(config):
@@ -14,7 +24,7 @@ def pytest_configure(config):
         header = ffi.set_source('repose',
                                 header.read(),
                                 include_dirs=['../src'],
-                                libraries=['archive', 'alpm'],
+                                libraries=['archive', 'alpm', 'crypto', 'z', 'zstd'],
                                 sources=SOURCES,
                                 extra_compile_args=CFLAGS)
 
@@ -28,3 +38,19 @@ def pytest_configure(config):
 def size_t_max():
     from repose import lib
     return lib.SIZE_MAX
+
+
+@pytest.fixture
+def buf():
+    from repose import ffi, lib
+    buf = ffi.new('struct buffer *')
+    yield buf
+    lib.buffer_release(buf)
+
+
+@pytest.fixture
+def arena():
+    from repose import lib
+    arena = lib.arena_new()
+    yield arena
+    lib.arena_free(arena)
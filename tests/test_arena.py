@@ -0,0 +1,60 @@
+from repose import ffi, lib
+
+
+def list_values(node):
+    while node != ffi.NULL:
+        yield ffi.string(ffi.cast('char *', node.data))
+        node = node.next
+
+
+def test_strndup(arena):
+    copy = lib.arena_strndup(arena, b'repose-git', 6)
+    assert ffi.string(copy) == b'repose'
+
+    copy = lib.arena_strndup(arena, b'short', 100)
+    assert ffi.string(copy) == b'short'
+
+
+def test_alignment(arena):
+    for size in (1, 3, 17, 100):
+        lib.arena_strndup(arena, b'x' * size, size)
+        ptr = lib.arena_alloc(arena, 8)
+        assert int(ffi.cast('uintptr_t', ptr)) % 16 == 0
+
+
+def test_large_allocation(arena):
+    small = lib.arena_strndup(arena, b'first', 5)
+    lib.arena_alloc(arena, 1 << 20)
+    lib.arena_strndup(arena, b'second', 6)
+
+    assert ffi.string(small) == b'first'
+    assert lib.arena_size(arena) >= 1 << 20
+
+
+def test_splice(arena):
+    other = lib.arena_new()
+    copy = lib.arena_strndup(other, b'spliced', 7)
+    size = lib.arena_size(other)
+    lib.arena_splice(arena, other)
+    lib.arena_free(other)
+
+    assert ffi.string(copy) == b'spliced'
+    assert lib.arena_size(arena) == size
+
+
+def test_package(arena):
+    pkg = lib.package_new(arena)
+    assert pkg.arena == arena
+
+    lib.package_set(pkg, lib.PKG_PKGNAME, b'repose', 6)
+    lib.package_set(pkg, lib.PKG_DESCRIPTION, b'first', 5)
+    lib.package_set(pkg, lib.PKG_DESCRIPTION, b'second', 6)
+    for depend in (b'pacman', b'libarchive', b'openssl'):
+        lib.package_set(pkg, lib.PKG_DEPENDS, depend, len(depend))
+
+    assert ffi.string(pkg.name) == b'repose'
+    assert ffi.string(pkg.desc) == b'second'
+    assert list(list_values(pkg.depends)) == [b'pacman', b'libarchive', b'openssl']
+
+    # Arena backed packages are released with the arena, not one by one
+    lib.package_free(pkg)
@@ -0,0 +1,55 @@
+import pytest
+from repose import ffi, lib
+
+
+def contents(buf):
+    return ffi.unpack(buf.data, buf.len)
+
+
+def test_puts(buf):
+    lib.buffer_puts(buf, b'%NAME%\n')
+    lib.buffer_puts(buf, b'repose')
+    assert contents(buf) == b'%NAME%\nrepose'
+
+
+@pytest.mark.parametrize('value', [0, 7, 10, 1234567890, 2**64 - 1])
+def test_put_uint(buf, value):
+    lib.buffer_put_uint(buf, value)
+    assert contents(buf) == str(value).encode()
+
+
+@pytest.mark.parametrize('value', [0, -1, 1449252432, -2**63, 2**63 - 1])
+def test_put_int(buf, value):
+    lib.buffer_put_int(buf, value)
+    assert contents(buf) == str(value).encode()
+
+
+def test_put_list(buf, arena):
+    pkg = lib.package_new(arena)
+    depends = [b'pacman', b'', b'libarchive' * 20, b'openssl']
+    for depend in depends:
+        lib.package_set(pkg, lib.PKG_DEPENDS, depend, len(depend))
+
+    lib.buffer_puts(buf, b'%DEPENDS%\n')
+    lib.buffer_put_list(buf, pkg.depends, b'\n')
+    assert contents(buf) == b'%DEPENDS%\n' + b''.join(d + b'\n' for d in depends)
+
+
+def test_put_empty_list(buf):
+    lib.buffer_puts(buf, b'head')
+    lib.buffer_put_list(buf, ffi.NULL, b'\n')
+    assert contents(buf) == b'head'
+
+
+def test_matches_printf(buf):
+    other = ffi.new('struct buffer *')
+    fmt = ffi.new('char[]', b'%%%s%%\n%zd\n\n')
+    header = ffi.new('char[]', b'ISIZE')
+    lib.buffer_printf(other, fmt, header, ffi.cast('size_t', 3145728))
+
+    lib.buffer_puts(buf, b'%ISIZE%\n')
+    lib.buffer_put_uint(buf, 3145728)
+    lib.buffer_puts(buf, b'\n\n')
+
+    assert contents(buf) == contents(other)
+    lib.buffer_release(other)
@@ -126,3 +126,15 @@ def test_parse_chunked(pkg, parser, chunksize):
     assert pkg.builddate == "Nov 28, 2015, 06:04:29"
     assert pkg.packager == 'Simon Gomizelj <simongmzlj@gmail.com>'
     assert pkg.licenses == ['GPL']
+
+
+@pytest.mark.parametrize('chunksize', [7, 4096, 100000])
+def test_parse_long_line(pkg, parser, chunksize):
+    desc = 'x' * 20000
+    data = '%DESC%\n' + desc + '\n\n%URL%\nhttp://github.com/vodik/repose\n\n'
+
+    for i in range(0, len(data), chunksize):
+        parser.feed(pkg, data[i:i+chunksize])
+
+    assert pkg.desc == desc
+    assert pkg.url == 'http://github.com/vodik/repose'
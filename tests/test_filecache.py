@@ -0,0 +1,62 @@
+import io
+import os
+import tarfile
+import pytest
+from repose import ffi, lib
+
+
+@pytest.fixture
+def pool(tmpdir):
+    poolfd = os.open(str(tmpdir), os.O_RDONLY | os.O_DIRECTORY)
+    yield tmpdir, poolfd
+    os.close(poolfd)
+
+
+def make_package(pool, name, version, arch='any'):
+    pkginfo = 'pkgname = {}\npkgver = {}\narch = {}\n'.format(name, version, arch).encode()
+    filename = '{}-{}-any.pkg.tar'.format(name, version)
+
+    with tarfile.open(str(pool.join(filename)), 'w') as tar:
+        info = tarfile.TarInfo('.PKGINFO')
+        info.size = len(pkginfo)
+        tar.addfile(info, io.BytesIO(pkginfo))
+
+
+def make_broken(pool, name, version):
+    pool.join('{}-{}-any.pkg.tar'.format(name, version)).write('truncated')
+
+
+def scan(poolfd, arch=ffi.NULL):
+    cache = lib.get_filecache(poolfd, ffi.NULL, arch, 0, 1, ffi.NULL, ffi.NULL)
+    versions = {}
+    for i in range(cache.count):
+        pkg = cache.pkgs[i]
+        if pkg != ffi.NULL:
+            versions[ffi.string(pkg.name)] = ffi.string(pkg.version)
+            lib.package_free(pkg)
+    lib.pkgcache_free(cache)
+    return versions
+
+
+def test_newest_wins(pool):
+    tmpdir, poolfd = pool
+    make_package(tmpdir, 'foo', '1.0-1')
+    make_package(tmpdir, 'foo', '2.0-1')
+    make_package(tmpdir, 'bar', '1.0-1')
+    assert scan(poolfd) == {b'foo': b'2.0-1', b'bar': b'1.0-1'}
+
+
+def test_broken_newest_falls_back(pool):
+    tmpdir, poolfd = pool
+    make_package(tmpdir, 'foo', '1.0-1')
+    make_broken(tmpdir, 'foo', '2.0-1')
+    make_broken(tmpdir, 'foo', '3.0-1')
+    make_broken(tmpdir, 'bar', '1.0-1')
+    assert scan(poolfd) == {b'foo': b'1.0-1'}
+
+
+def test_wrong_arch_falls_back(pool):
+    tmpdir, poolfd = pool
+    make_package(tmpdir, 'foo', '1.0-1')
+    make_package(tmpdir, 'foo', '2.0-1', arch='i686')
+    assert scan(poolfd, b'x86_64') == {b'foo': b'1.0-1'}
@@ -0,0 +1,74 @@
+import pytest
+from repose import ffi, lib
+from test_desc import DescParser
+from wrappers import Package
+
+
+PATHS = [b'usr/',
+         b'usr/bin/',
+         b'usr/bin/repose',
+         b'usr/share/',
+         b'usr/share/man/',
+         b'usr/share/man/man1/',
+         b'usr/share/man/man1/repose.1.gz',
+         b'usr/share/zsh/',
+         b'usr/share/zsh/site-functions/',
+         b'usr/share/zsh/site-functions/_repose']
+
+
+@pytest.fixture
+def filelist():
+    filelist = lib.filelist_new()
+    yield filelist
+    lib.filelist_free(filelist)
+
+
+def fill(filelist, paths):
+    for path in paths:
+        lib.filelist_add(filelist, path, len(path))
+
+
+def test_get(filelist, buf):
+    paths = PATHS * 5
+    fill(filelist, paths)
+
+    assert lib.filelist_count(filelist) == len(paths)
+    for idx, path in enumerate(paths):
+        assert lib.filelist_get(filelist, idx, buf) == 0
+        assert ffi.string(buf.data, buf.len) == path
+    assert lib.filelist_get(filelist, len(paths), buf) == -1
+
+
+def test_write(filelist, buf):
+    fill(filelist, PATHS)
+    lib.filelist_write(filelist, buf)
+    assert ffi.string(buf.data, buf.len) == b''.join(p + b'\n' for p in PATHS)
+
+
+@pytest.mark.parametrize('length', [63, 127, 255])
+def test_write_fills_buffer(filelist, buf, length):
+    # The path and its newline fill the buffer to exactly a power of two,
+    # leaving the terminator to need room of its own
+    path = b'usr/share/' + b'x' * (length - 10)
+    fill(filelist, [path])
+    lib.filelist_write(filelist, buf)
+    assert ffi.string(buf.data, buf.len) == path + b'\n'
+    assert buf.data[buf.len] == b'\0'
+
+
+def test_front_coding(filelist):
+    paths = [b'usr/share/locale/%d/LC_MESSAGES/repose.mo' % i for i in range(1000)]
+    fill(filelist, paths)
+    assert lib.filelist_size(filelist) < sum(len(p) for p in paths) // 2
+
+
+def test_desc_files(buf):
+    pkg = Package(name='repose-git', version='5.19.g82c3d4a-1')
+    data = '%FILES%\n' + ''.join(p.decode() + '\n' for p in PATHS)
+    DescParser().feed(pkg, data)
+
+    files = pkg._struct.files
+    assert lib.filelist_count(files) == len(PATHS)
+    lib.filelist_write(files, buf)
+    assert ffi.string(buf.data, buf.len) == b''.join(p + b'\n' for p in PATHS)
+    lib.filelist_free(files)
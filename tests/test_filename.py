@@ -0,0 +1,43 @@
+import pytest
+import errno
+from repose import ffi, lib
+
+
+def parse(filename):
+    pkgfile = ffi.new('struct pkgfile *')
+    if lib.parse_package_filename(filename, pkgfile) < 0:
+        return None
+
+    result = (ffi.string(pkgfile.name),
+              ffi.string(pkgfile.version),
+              ffi.string(pkgfile.arch))
+    lib.free(pkgfile.name)
+    return result
+
+
+@pytest.mark.parametrize('filename,expected', [
+    (b'repose-git-5.19.g82c3d4a-1-x86_64.pkg.tar.xz',
+     (b'repose-git', b'5.19.g82c3d4a-1', b'x86_64')),
+    (b'systemd-209-1-x86_64.pkg.tar.zst',
+     (b'systemd', b'209-1', b'x86_64')),
+    (b'python-foo-1:2.0-3-any.pkg.tar',
+     (b'python-foo', b'1:2.0-3', b'any')),
+])
+def test_parse_package_filename(filename, expected):
+    assert parse(filename) == expected
+
+
+@pytest.mark.parametrize('filename', [
+    b'repose-git-5.19.g82c3d4a-1-x86_64.pkg.tar.xz.sig',
+    b'repose-git-5.19.g82c3d4a-1-x86_64.pkg.tar.sig',
+    b'repose-git-5.19.g82c3d4a-1-x86_64.tar.gz',
+    b'foo.db',
+    b'foo.files.tar.gz',
+    b'209-1-x86_64.pkg.tar.xz',
+    b'systemd-1-x86_64.pkg.tar.xz',
+    b'-209-1-x86_64.pkg.tar.xz',
+    b'systemd-209-1-.pkg.tar.xz',
+])
+def test_parse_package_filename_invalid(filename):
+    assert parse(filename) is None
+    assert ffi.errno == errno.EINVAL
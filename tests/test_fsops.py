@@ -0,0 +1,111 @@
+import errno
+import os
+import pytest
+from repose import ffi, lib
+
+
+@pytest.fixture
+def dirs(tmpdir):
+    pool = tmpdir.mkdir('pool')
+    root = tmpdir.mkdir('root')
+    poolfd = os.open(str(pool), os.O_RDONLY | os.O_DIRECTORY)
+    rootfd = os.open(str(root), os.O_RDONLY | os.O_DIRECTORY)
+    yield pool, poolfd, root, rootfd
+    os.close(poolfd)
+    os.close(rootfd)
+
+
+def run(*ops):
+    batch = ffi.new('struct fsop[]', len(ops))
+    keep = []
+    for op, fields in zip(batch, ops):
+        for key, value in fields.items():
+            if isinstance(value, bytes):
+                value = ffi.new('char[]', value)
+                keep.append(value)
+            setattr(op, key, value)
+
+    lib.fsops_run(batch, len(ops))
+    return [op.result for op in batch]
+
+
+def test_stat(dirs):
+    pool, poolfd, _, _ = dirs
+    pool.join('repose-1.0-1-any.pkg.tar.xz').write('x' * 42)
+
+    st = ffi.new('struct stat *')
+    assert run({'type': lib.FSOP_STAT, 'dirfd': poolfd,
+                'path': b'repose-1.0-1-any.pkg.tar.xz', 'st': st},
+               {'type': lib.FSOP_STAT, 'dirfd': poolfd,
+                'path': b'missing-1.0-1-any.pkg.tar.xz'}) == [0, -errno.ENOENT]
+    assert st.st_size == 42
+
+
+def test_links(dirs):
+    pool, poolfd, root, rootfd = dirs
+    names = ['pkg{}-1.0-1-any.pkg.tar.xz'.format(i) for i in range(20)]
+    for name in names:
+        pool.join(name).write(name)
+
+    ops = []
+    for i, name in enumerate(names):
+        if i % 2:
+            ops.append({'type': lib.FSOP_LINK, 'dirfd': poolfd, 'path': name.encode(),
+                        'newdirfd': rootfd, 'newpath': name.encode()})
+        else:
+            ops.append({'type': lib.FSOP_SYMLINK, 'path': str(pool.join(name)).encode(),
+                        'newdirfd': rootfd, 'newpath': name.encode()})
+
+    assert run(*ops) == [0] * len(names)
+    for i, name in enumerate(names):
+        assert root.join(name).read() == name
+        assert root.join(name).islink() == (i % 2 == 0)
+
+    # Links that already exist are reported, not replaced
+    assert run(*ops) == [-errno.EEXIST] * len(names)
+
+
+def test_unlink(dirs):
+    _, _, root, rootfd = dirs
+    root.join('repose-1.0-1-any.pkg.tar.xz').write('')
+
+    assert run({'type': lib.FSOP_UNLINK, 'dirfd': rootfd,
+                'path': b'repose-1.0-1-any.pkg.tar.xz'},
+               {'type': lib.FSOP_UNLINK, 'dirfd': rootfd,
+                'path': b'repose-1.0-1-any.pkg.tar.xz'}) == [0, -errno.ENOENT]
+    assert not root.join('repose-1.0-1-any.pkg.tar.xz').exists()
+
+
+def test_batch_beyond_queue_depth(dirs):
+    # Several times the 64 requests the ring keeps in flight, so slots
+    # get handed back and reused
+    pool, poolfd, root, rootfd = dirs
+    names = ['pkg{}-1.0-1-any.pkg.tar.xz'.format(i).encode() for i in range(300)]
+    for i, name in enumerate(names):
+        if i % 3:
+            pool.join(name.decode()).write('x' * i)
+
+    stats = [ffi.new('struct stat *') for _ in names]
+    results = run(*[{'type': lib.FSOP_STAT, 'dirfd': poolfd, 'path': name, 'st': st}
+                    for name, st in zip(names, stats)])
+
+    for i, (name, st, result) in enumerate(zip(names, stats, results)):
+        if i % 3 == 0:
+            assert result == -errno.ENOENT
+            continue
+
+        expected = os.stat(str(pool.join(name.decode())))
+        assert result == 0
+        assert st.st_dev == expected.st_dev
+        assert st.st_ino == expected.st_ino
+        assert st.st_mode == expected.st_mode
+        assert st.st_size == expected.st_size == i
+        assert st.st_mtim.tv_sec * 10**9 + st.st_mtim.tv_nsec == expected.st_mtime_ns
+
+    results = run(*[{'type': lib.FSOP_LINK, 'dirfd': poolfd, 'path': name,
+                     'newdirfd': rootfd, 'newpath': name} for name in names])
+    assert results == [-errno.ENOENT if i % 3 == 0 else 0 for i in range(len(names))]
+
+    results = run(*[{'type': lib.FSOP_UNLINK, 'dirfd': rootfd, 'path': name} for name in names])
+    assert results == [-errno.ENOENT if i % 3 == 0 else 0 for i in range(len(names))]
+    assert root.listdir() == []
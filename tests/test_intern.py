@@ -0,0 +1,53 @@
+import pytest
+from repose import ffi, lib
+from test_desc import DescParser, REPOSE_DEPENDS
+from wrappers import Package
+
+
+@pytest.fixture
+def stats():
+    lib.intern_release()
+    yield ffi.new('struct intern_stats *')
+    lib.intern_release()
+
+
+def test_intern_identity(stats):
+    first = lib.intern(b'glibc', 5)
+    second = lib.intern(b'glibc', 5)
+    other = lib.intern(b'gcc-libs', 8)
+
+    assert first == second
+    assert first != other
+    assert ffi.string(first) == b'glibc'
+
+
+def test_intern_length(stats):
+    prefix = lib.intern(b'gcc-libs', 3)
+    full = lib.intern(b'gcc-libs', 8)
+
+    assert ffi.string(prefix) == b'gcc'
+    assert prefix != full
+    assert lib.intern(b'gcc', 3) == prefix
+
+
+def test_intern_stats(stats):
+    for name in (b'sh', b'sh', b'sh', b'bash'):
+        lib.intern(name, len(name))
+
+    lib.intern_stats(stats)
+    assert stats.lookups == 4
+    assert stats.hits == 2
+    assert stats.strings == 2
+    assert stats.bytes == len(b'sh\0bash\0')
+    assert stats.saved == 2 * len(b'sh\0')
+
+
+def test_shared_depends(stats):
+    pkgs = [Package(name='repose-git', version='1'),
+            Package(name='repose', version='1')]
+    for pkg in pkgs:
+        DescParser().feed(pkg, REPOSE_DEPENDS)
+
+    depends = [pkg._struct.depends for pkg in pkgs]
+    assert depends[0].data == depends[1].data
+    assert pkgs[0].depends == pkgs[1].depends == ['pacman', 'libarchive', 'gnupg']
@@ -0,0 +1,83 @@
+import pytest
+import random
+from repose import ffi, lib
+from wrappers import make_packages
+
+
+def cache_names(cache):
+    for i in range(cache.count):
+        pkg = cache.pkgs[i]
+        if pkg != ffi.NULL:
+            yield ffi.string(pkg.name)
+
+
+@pytest.fixture
+def cache():
+    cache = lib.pkgcache_new(0)
+    yield cache
+    lib.pkgcache_free(cache)
+
+
+def test_find(cache):
+    names = [b'pkg%05d' % i for i in range(5000)]
+    pkgs, keepalive = make_packages(names)
+    for pkg in pkgs:
+        lib.pkgcache_add(cache, pkg)
+
+    assert cache.entries == len(names)
+    assert list(cache_names(cache)) == names
+    for pkg, name in zip(pkgs, names):
+        assert lib.pkgcache_find(cache, name) == pkg
+    assert lib.pkgcache_find(cache, b'missing') == ffi.NULL
+
+
+def test_remove(cache):
+    names = [b'pkg%05d' % i for i in range(5000)]
+    pkgs, keepalive = make_packages(names)
+    for pkg in pkgs:
+        lib.pkgcache_add(cache, pkg)
+    for pkg in pkgs[::2]:
+        lib.pkgcache_remove(cache, pkg)
+
+    assert cache.entries == len(names) // 2
+    assert list(cache_names(cache)) == names[1::2]
+    for i, (pkg, name) in enumerate(zip(pkgs, names)):
+        found = lib.pkgcache_find(cache, name)
+        assert found == (ffi.NULL if i % 2 == 0 else pkg)
+
+    # Refilling has to reuse the deleted slots and the holes
+    for pkg in pkgs[::2]:
+        lib.pkgcache_add(cache, pkg)
+    assert sorted(cache_names(cache)) == names
+    for pkg, name in zip(pkgs, names):
+        assert lib.pkgcache_find(cache, name) == pkg
+
+
+def test_replace_keeps_order(cache):
+    names = [b'alpha', b'beta', b'gamma']
+    pkgs, keepalive = make_packages(names + [b'beta'])
+    for pkg in pkgs[:3]:
+        lib.pkgcache_add(cache, pkg)
+
+    lib.pkgcache_replace(cache, pkgs[3], pkgs[1])
+    assert cache.entries == 3
+    assert list(cache_names(cache)) == names
+    assert lib.pkgcache_find(cache, b'beta') == pkgs[3]
+
+
+@pytest.mark.parametrize('shuffle', [False, True])
+def test_sort(cache, shuffle):
+    names = [b'pkg%05d' % i for i in range(1000)]
+    if shuffle:
+        random.shuffle(names)
+
+    pkgs, keepalive = make_packages(names)
+    for pkg in pkgs:
+        lib.pkgcache_add(cache, pkg)
+    lib.pkgcache_remove(cache, pkgs[0])
+    lib.pkgcache_sort(cache)
+
+    assert cache.count == cache.entries
+    assert list(cache_names(cache)) == sorted(names[1:])
+    for pkg, name in zip(pkgs[1:], names[1:]):
+        assert lib.pkgcache_find(cache, name) == pkg
@@ -78,3 +78,15 @@ def test_parse_chunked(pkg, parser, chunksize):
     assert pkg.builddate == "Oct 30, 2016, 16:09:47"
     assert pkg.packager == 'Simon Gomizelj <simongmzlj@gmail.com>'
     assert pkg.licenses == ['GPL']
+
+
+@pytest.mark.parametrize('chunksize', [7, 4096, 100000])
+def test_parse_long_line(pkg, parser, chunksize):
+    desc = 'x' * 20000
+    data = 'pkgdesc = ' + desc + '\nsize = 63488\n'
+
+    for i in range(0, len(data), chunksize):
+        parser.feed(pkg, data[i:i+chunksize])
+
+    assert pkg.desc == desc
+    assert pkg.isize == 63488
@@ -0,0 +1,89 @@
+import os
+import tarfile
+import pytest
+from repose import ffi, lib
+
+
+POOL = [b'foo-1.0-1-any.pkg.tar.xz', b'bar-1.0-1-any.pkg.tar.xz']
+
+
+@pytest.fixture
+def pool(tmpdir):
+    for filename in POOL:
+        tmpdir.join(filename.decode()).write(filename)
+    poolfd = os.open(str(tmpdir), os.O_RDONLY | os.O_DIRECTORY)
+    yield tmpdir, poolfd
+    os.close(poolfd)
+
+
+def stat(dirfd, filename):
+    path = ffi.new('char[]', filename)
+    st = ffi.new('struct stat *')
+    op = ffi.new('struct fsop *', {'type': lib.FSOP_STAT, 'dirfd': dirfd,
+                                   'path': path, 'st': st})
+    lib.fsops_run(op, 1)
+    assert op.result == 0
+    return st
+
+
+def scan(poolfd, listing, wanted):
+    """Go through the scan cache like get_filecache does: the whole
+    directory listing is known, but only the wanted files are looked
+    up. Returns the ones that were hits."""
+    cache = lib.scancache_load(poolfd, b'pool.cache')
+
+    names = [ffi.new('char[]', filename) for filename in listing]
+    lib.scancache_prune(cache, names, len(names))
+    lib.scancache_begin(cache, len(wanted))
+
+    hits = []
+    pkg = ffi.new('struct pkg **')
+    for idx, filename in enumerate(wanted):
+        st = stat(poolfd, filename)
+        if lib.scancache_lookup(cache, idx, filename, st, ffi.NULL, pkg):
+            hits.append(filename)
+        else:
+            lib.scancache_store(cache, idx, filename, st, ffi.NULL)
+
+    assert lib.scancache_save(cache, poolfd, b'pool.cache') == 0
+    lib.scancache_free(cache)
+    return hits
+
+
+def cached(pool):
+    with tarfile.open(str(pool.join('pool.cache'))) as tar:
+        return sorted(name.encode() for name in tar.getnames())
+
+
+def test_full_scan(pool):
+    _, poolfd = pool
+    assert scan(poolfd, POOL, POOL) == []
+    assert scan(poolfd, POOL, POOL) == POOL
+
+
+def test_targeted_scan_keeps_other_entries(pool):
+    tmpdir, poolfd = pool
+    scan(poolfd, POOL, POOL)
+
+    assert scan(poolfd, POOL, POOL[:1]) == POOL[:1]
+    assert cached(tmpdir) == sorted(POOL)
+    assert scan(poolfd, POOL, POOL) == POOL
+
+
+def test_changed_file_is_rescanned(pool):
+    tmpdir, poolfd = pool
+    scan(poolfd, POOL, POOL)
+
+    tmpdir.join(POOL[0].decode()).write('rebuilt')
+    assert scan(poolfd, POOL, POOL) == POOL[1:]
+    assert cached(tmpdir) == sorted(POOL)
+    assert scan(poolfd, POOL, POOL) == POOL
+
+
+def test_removed_file_is_dropped(pool):
+    tmpdir, poolfd = pool
+    scan(poolfd, POOL, POOL)
+
+    tmpdir.join(POOL[1].decode()).remove()
+    assert scan(poolfd, POOL[:1], POOL[:1]) == POOL[:1]
+    assert cached(tmpdir) == POOL[:1]
@@ -0,0 +1,46 @@
+import gzip
+import pytest
+from repose import ffi, lib
+
+
+@pytest.fixture
+def index():
+    index = lib.segindex_new()
+    yield index
+    lib.segindex_free(index)
+
+
+def compress(out, data):
+    assert lib.segment_compress(lib.ARCHIVE_FILTER_GZIP, 0, data, len(data), out) == 0
+
+
+def test_supported():
+    assert lib.segment_supported(lib.ARCHIVE_FILTER_GZIP)
+    assert lib.segment_supported(lib.ARCHIVE_FILTER_ZSTD)
+    assert not lib.segment_supported(lib.ARCHIVE_FILTER_XZ)
+
+
+def test_segments_concatenate(buf):
+    segments = [b'repose-1.0-1/desc\n' * 50, b'', b'pacman-5.0-1/desc\n' * 50]
+    for segment in segments:
+        compress(buf, segment)
+
+    data = ffi.unpack(buf.data, buf.len)
+    assert gzip.decompress(data) == b''.join(segments)
+
+
+def test_index_find(index):
+    lib.segindex_add(index, b'b' * 64, 100, 20)
+    lib.segindex_add(index, b'a' * 64, 0, 100)
+
+    segment = lib.segindex_find(index, b'a' * 64)
+    assert segment.offset == 0 and segment.len == 100
+
+    segment = lib.segindex_find(index, b'b' * 64)
+    assert segment.offset == 100 and segment.len == 20
+
+    assert lib.segindex_find(index, b'c' * 64) == ffi.NULL
+
+
+def test_empty_index(index):
+    assert lib.segindex_find(index, b'a' * 64) == ffi.NULL
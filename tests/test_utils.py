@@ -1,5 +1,6 @@
 import pytest
 import errno
+import os
 from repose import ffi, lib
 
 
@@ -52,3 +53,37 @@ def test_parse_time():
 
     assert lib.parse_time(arg, out) == 0
     assert out[0] == 1448690669
+
+
+@pytest.mark.parametrize('input,value', [(b'19', 19), (b'-5', -5), (b'0', 0)])
+def test_parse_int(input, value):
+    arg = ffi.new('char[]', input)
+    out = ffi.new('int *')
+
+    assert lib.parse_int(arg, out) == 0
+    assert out[0] == value
+
+
+@pytest.mark.parametrize('input', [b'', b'3x', b'99999999999'])
+def test_parse_int_invalid(input):
+    arg = ffi.new('char[]', input)
+    out = ffi.new('int *')
+
+    assert lib.parse_int(arg, out) == -1
+    assert out[0] == 0
+
+
+@pytest.mark.parametrize('size', [0, 1, 5 * 1048576 + 17])
+def test_copy_file(tmpdir, size):
+    data = os.urandom(size)
+    tmpdir.join('src').write_binary(data)
+
+    src = os.open(str(tmpdir.join('src')), os.O_RDONLY)
+    dest = os.open(str(tmpdir.join('dest')), os.O_WRONLY | os.O_CREAT | os.O_EXCL, 0o644)
+    try:
+        assert lib.copy_file(dest, src) == 0
+    finally:
+        os.close(src)
+        os.close(dest)
+
+    assert tmpdir.join('dest').read_binary() == data
@@ -1,7 +1,7 @@
 import abc
 import weakref
 from datetime import datetime
-from repose import ffi
+from repose import ffi, lib
 
 
 class marshal_int(object):
@@ -104,3 +104,15 @@ class Parser(object):
     @abc.abstractmethod
     def feed_parser(self, parser, pkg, data):
         return
+
+
+def make_packages(names):
+    keepalive = []
+    pkgs = []
+    for name in names:
+        cname = ffi.new('char[]', name)
+        pkg = ffi.new('struct pkg *', {'name': cname,
+                                       'name_hash': lib.pkgcache_hash(cname)})
+        keepalive.append(cname)
+        pkgs.append(pkg)
+    return pkgs, keepalive